@@ -32,25 +32,52 @@ void dump(const pcb2gcode::job_tool_paths_t &jtp) {
 
 int main(int argc, char *argv[])
 {
-    srand(time(0));
-    if (argc < 2) {
-        cout << "Use: pcb2gcode file.p2g" << endl;
+    // --export-only skips inputs and jobs, and loads their toolpaths instead.
+    // --dry-run simulates G-code outputs, and logs their timing, unwritten.
+    bool export_only = false;
+    bool dry_run = false;
+    const char *fileName = nullptr;
+    for (int i=1; i<argc; i++) {
+        if (string(argv[i]) == "--export-only")
+            export_only = true;
+        else if (string(argv[i]) == "--dry-run")
+            dry_run = true;
+        else
+            fileName = argv[i];
+    }
+    if (!fileName) {
+        cout << "Use: pcb2gcode [--export-only] [--dry-run] file.p2g" << endl;
         return 0;
     }
 
     try {
         DEBUG("Loading configuration file...");
         pcb2gcode::context_t config;
-        config.fileName = pcb2gcode::getRealPath(argv[1]);
+        config.fileName = pcb2gcode::getRealPath(fileName);
         config.yaml = YAML::LoadFile(config.fileName);
+        config.dry_run = dry_run;
 
         if (config.yaml["debug"].as<bool>(false))
             mkdir("p2g-debug-out", 0700);
 
+        // Toolpaths of all jobs, saved for --export-only.
+        string toolpaths = config.yaml["toolpaths"].as<string>("");
+        if (!toolpaths.empty())
+            toolpaths = pcb2gcode::getRealPath(toolpaths);
+        if (export_only && toolpaths.empty())
+            throw pcb2gcode::error("--export-only needs a toolpaths file in the configuration.");
+
         DEBUG("Loading tools...");
         load_tools(config);
-        do_inputs(config);
-        do_jobs(config);
+        load_machine(config);
+        if (export_only) {
+            load_toolpaths(config, toolpaths);
+        } else {
+            do_inputs(config);
+            do_jobs(config);
+            if (!toolpaths.empty())
+                save_toolpaths(config, toolpaths);
+        }
         do_outputs(config);
     } catch (pcb2gcode::error e) {
         cout << "ERROR: " << e << endl;
@@ -59,9 +59,66 @@ struct tool_t {
 // Map of tools: Name -> object
 typedef std::map< std::string, tool_t > tool_map_t;
 
+// Machine kinematics, shared by path sorting and time estimates.
+struct machine_t {
+	double velocity[3]{1000, 1000, 1000}; // mm/min, per axis, for rapid moves
+	double acceleration[3]{16.7, 16.7, 16.7}; // mm/s², per axis
+	double retract_time{1}; // s, to lift to travel height and plunge back
+	double tool_change_time{30}; // s
+	double junction_deviation{0.01}; // mm, for speed through corners, as in GRBL
+
+	// Time (s) to move d mm from stop to stop, with a trapezoidal speed profile.
+	static double move_time(double d, double v, double a) {
+		d = fabs(d);
+		v /= 60; // mm/s
+		if (!d || !v || !a)
+			return 0;
+
+		double dm = v * v / a; // Distance to reach max speed, and stop again
+		if (d < dm)
+			return 2 * sqrt(d / a);
+		return v / a + d / v;
+	}
+
+	// Rapid move, with each axis limited on its own.
+	double rapid_time(double dx, double dy, double dz=0) const {
+		return std::max({
+			move_time(dx, velocity[0], acceleration[0]),
+			move_time(dy, velocity[1], acceleration[1]),
+			move_time(dz, velocity[2], acceleration[2])
+		});
+	}
+
+	// Straight XY move at the given feed (mm/min).
+	double feed_time(double d, double feed) const {
+		return move_time(d, std::min({feed, velocity[0], velocity[1]}), std::min(acceleration[0], acceleration[1]));
+	}
+
+	// Vertical move at the given feed (mm/min).
+	double plunge_time(double dz, double feed) const {
+		return move_time(dz, std::min(feed, velocity[2]), acceleration[2]);
+	}
+};
+
 // A single point
 typedef cv::Point point_t;
 
+// Points of stored paths are fixed point, in 1/256 px, as the `shift` of
+// OpenCV drawing functions. Raster stages work in whole pixels, and jobs
+// convert their paths as they store them.
+const int point_shift = 8;
+const int point_one = 1 << point_shift;
+
+// Path point at a pixel position, which may fall between pixels.
+inline point_t subpixel(cv::Point2d px) {
+	return point_t(std::lround(px.x * point_one), std::lround(px.y * point_one));
+}
+
+// Nearest whole pixel of a path point.
+inline point_t pixel(point_t p) {
+	return point_t((p.x + point_one/2) >> point_shift, (p.y + point_one/2) >> point_shift);
+}
+
 // A path, no metadatametadata
 typedef std::vector<point_t> points_t;
 
@@ -102,6 +159,19 @@ typedef std::map<std::string, paths_t> tool_paths_t;
 // Paths for the entire code: Job -> {Tool -> paths}
 typedef std::map<std::string, tool_paths_t> job_tool_paths_t;
 
+// Whole pixel paths to path points, in place.
+inline void pixels_to_points(paths_t &paths) {
+	for (auto &path : paths)
+		for (auto &p : path.points) {
+			p.x *= point_one;
+			p.y *= point_one;
+		}
+}
+inline void pixels_to_points(tool_paths_t &tool_paths) {
+	for (auto &tp : tool_paths)
+		pixels_to_points(tp.second);
+}
+
 inline void iterate_job_tool_paths(
 	job_tool_paths_t &jtp, 
 	std::function<void(std::string, std::string, paths_t &p)> f
@@ -126,14 +196,45 @@ struct metapath_t {
 
 	tool_t *tool;
 	path_t *path;
+	size_t start; // Entry vertex of closed loops
+	const cv::Mat *free_area; // Of the job, see context_t
+	const std::string *job; // Name, for statistics
+	point_t offset; // Of its tile, on panels
 
-	metapath_t() : priority(0), backwards(false), tool(0), path(0) {};
+	metapath_t() : priority(0), backwards(false), tool(0), path(0), start(0), free_area(0), job(0), offset(0, 0) {};
 	void reverse() {
 		if (!reversible) return;
 		swap(entry, rentry);
 		swap(exit, rexit);
 		backwards = !backwards;
 	}
+
+	// Closed loops may be entered at any vertex.
+	bool closed() const {
+		auto &points = path->points;
+		return points.size() > 2 && points.front() == points.back();
+	}
+	void set_start(size_t i) {
+		start = i;
+		entry = exit = rentry = rexit = path->points[i] + offset;
+	}
+
+	// Calls f(point) for every point, in cutting order and on its tile.
+	// Closed loops go from their entry vertex all the way around, back to it.
+	template<class F>
+	void visit_points(F f) const {
+		auto &points = path->points;
+		size_t n = points.size();
+		if (!closed()) {
+			for (size_t k=0; k<n; k++)
+				f(points[backwards ? n-1-k : k] + offset);
+			return;
+		}
+
+		size_t m = n-1; // Last point repeats the first
+		for (size_t k=0; k<=m; k++)
+			f(points[backwards ? (start + m - k % m) % m : (start + k) % m] + offset);
+	}
 };
 typedef std::vector< metapath_t > metapaths_t;
 
@@ -145,11 +246,36 @@ struct context_t {
 
 	tool_map_t tools;
 	std::vector<std::string> tool_predrill_order;
+	machine_t machine;
 
 	std::map<std::string, cv::Mat> inputs;
 	job_tool_paths_t job_tool_paths;
 
+	// Job -> white where its mills may cut anything, so they may cross at depth.
+	std::map<std::string, cv::Mat> free_areas;
+
+	// Offsets (1/point_one px) of the tiles of a panel, if replicated. Paths
+	// are those of one tile.
+	std::vector<point_t> instances;
+
+	// Pixels to output pixels, from export options. Paths are kept as found,
+	// and placed by formatters as they are written.
+	cv::Matx23d transform{1, 0, 0, 0, 1, 0};
+
+	// Output pixels of a path point.
+	cv::Point2d place(cv::Point2d p) const {
+		p.x /= point_one;
+		p.y /= point_one;
+		return cv::Point2d(
+			transform(0, 0)*p.x + transform(0, 1)*p.y + transform(0, 2),
+			transform(1, 0)*p.x + transform(1, 1)*p.y + transform(1, 2)
+		);
+	}
+
 	YAML::Node yaml;
+
+	// Simulate G-code outputs instead of writing them.
+	bool dry_run{false};
 };
 
 // Get the bounding box from a gcode file
@@ -165,18 +291,36 @@ bool job_alignment_holes(context_t &context, std::string jobName);
 bool job_raw_import(context_t &context, std::string jobName);
 
 bool load_tools(context_t &context);
+bool load_machine(context_t &context);
 cv::Rect2d gerber_bounds(std::string edgeFileName);
 bool do_inputs(context_t &context);
 cv::Mat job_input_layer(context_t context, std::string jobName, std::string layerName, cv::Mat layer=cv::Mat());
 bool do_jobs(context_t &context);
+bool job_cache_key(context_t &context, std::string jobName, uint64_t &key);
+bool job_cache_load(context_t &context, std::string jobName, uint64_t key);
+bool job_cache_store(context_t &context, std::string jobName, uint64_t key, size_t limit);
 bool do_outputs(context_t &context);
+bool save_toolpaths(context_t &context, std::string file);
+bool load_toolpaths(context_t &context, std::string file);
 path_t simplify_path(const path_t &src, double tol=1.0);
 
-typedef std::vector<std::string> (*formatter_t)(context_t &context, const metapaths_t &paths, bool mirror);
-std::vector<std::string> out_gcode(context_t &context, const metapaths_t &paths, bool mirror);
-std::vector<std::string> out_hpgl(context_t &context, const metapaths_t &paths, bool mirror);
-std::vector<std::string> out_ncdrill(context_t &context, const metapaths_t &paths, bool mirror);
-std::vector<std::string> out_preview(context_t &context, const metapaths_t &paths, bool mirror);
+// A path segment in output space, either a straight line or a circular arc.
+struct segment_t {
+	enum type_e {
+		line, arc_cw, arc_ccw
+	} type;
+	cv::Point2d end;
+	cv::Point2d center{}; // Arcs only
+};
+typedef std::vector<segment_t> segments_t;
+segments_t fit_arcs(const std::vector<cv::Point2d> &points, double tol);
+
+class writer_t;
+typedef void (*formatter_t)(context_t &context, const metapaths_t &paths, bool mirror, writer_t &out);
+void out_gcode(context_t &context, const metapaths_t &paths, bool mirror, writer_t &out);
+void out_hpgl(context_t &context, const metapaths_t &paths, bool mirror, writer_t &out);
+void out_ncdrill(context_t &context, const metapaths_t &paths, bool mirror, writer_t &out);
+void out_preview(context_t &context, const metapaths_t &paths, bool mirror, writer_t &out);
 
 inline cv::Scalar tool_color(tool_t t) {
 	if (t.diameter > 0.5)
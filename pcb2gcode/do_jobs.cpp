@@ -3,6 +3,12 @@
 namespace pcb2gcode {
 
 bool do_jobs(context_t &context) {
+    // Job results are cached up to this size (MB), if enabled. Debug runs
+    // always run their jobs, for the images.
+    size_t cache_limit = context.yaml["job-cache"].as<double>(0) * 1024 * 1024;
+    if (context.yaml["debug"].as<bool>(false))
+        cache_limit = 0;
+
     for (const auto &inf : context.yaml["jobs"]) {
         if (!inf.second["enabled"].as<bool>(true))
             continue;
@@ -13,20 +19,31 @@ bool do_jobs(context_t &context) {
         if (!inf.second["enabled"].as<bool>(true))
             continue;
 
-        if (jobType == "isolate")
-            job_isolate(context, jobName);
-        if (jobType == "paint")
-            job_paint(context, jobName);
-        if (jobType == "voronoi")
-            job_voronoi(context, jobName);
-        if (jobType == "drill")
-            job_drill(context, jobName);
-        if (jobType == "cutout")
-            job_cutout(context, jobName);
-        if (jobType == "alignment_holes")
-            job_alignment_holes(context, jobName);
-        if (jobType == "raw_import")
-            job_raw_import(context, jobName);
+        uint64_t key = 0;
+        bool cacheable = cache_limit && job_cache_key(context, jobName, key);
+        if (cacheable && job_cache_load(context, jobName, key)) {
+            DEBUG("Job " << jobName << " loaded from cache.");
+        } else {
+            if (cacheable)
+                DEBUG("Job " << jobName << " not in cache, running it.");
+
+            if (jobType == "isolate")
+                job_isolate(context, jobName);
+            if (jobType == "paint")
+                job_paint(context, jobName);
+            if (jobType == "voronoi")
+                job_voronoi(context, jobName);
+            if (jobType == "drill")
+                job_drill(context, jobName);
+            if (jobType == "cutout")
+                job_cutout(context, jobName);
+            if (jobType == "alignment_holes")
+                job_alignment_holes(context, jobName);
+            if (jobType == "raw_import")
+                job_raw_import(context, jobName);
+            if (cacheable)
+                job_cache_store(context, jobName, key, cache_limit);
+        }
 
         // Predrilling
         auto &tool_paths = context.job_tool_paths[jobName];
@@ -1,8 +1,23 @@
+#include <chrono>
 #include <fstream>
 #include <limits>
+#include <mutex>
+#include <random>
+#include <set>
+#include <sstream>
 #include <pcb2gcode.hpp>
 #include <pcb2gcode/metapath_sort_anneal_reversion.hpp>
 #include <pcb2gcode/metapath_sort_greed_insert.hpp>
+#include <pcb2gcode/metapath_sort_hilbert.hpp>
+#include <pcb2gcode/metapath_sort_nearest.hpp>
+#include <pcb2gcode/metapath_sort_2opt.hpp>
+#include <pcb2gcode/metapath_sort_atsp.hpp>
+#include <pcb2gcode/metapath_sort_clusters.hpp>
+#include <pcb2gcode/metapath_sort_entries.hpp>
+#include <pcb2gcode/metapath_sort_multistart.hpp>
+#include <pcb2gcode/metapath_sort_tools.hpp>
+#include <pcb2gcode/sink.hpp>
+#include <pcb2gcode/writer.hpp>
 
 namespace pcb2gcode {
 
@@ -41,7 +56,8 @@ static formatter_table_entry_t formatters [] {
 	{"preview", out_preview, false, ".png .jpg "},
 };
 
-static void for_all_points(context_t &context, std::function<void(point_t &p)> f) {
+template<class F>
+static void for_all_points(context_t &context, F f) {
 	for (auto &job_tool_paths : context.job_tool_paths)
 		for (auto &tool_paths : job_tool_paths.second)
 			for (auto &path : tool_paths.second)
@@ -56,7 +72,7 @@ static void for_used_tools(context_t &context, std::function<void(std::string to
 			f(tool_paths.first);
 }
 
-// pixel-space
+// Path points, 1/point_one px.
 static cv::Rect2i get_toolpath_bounds(context_t &context) {
 	int x0 = std::numeric_limits<int>::max();
 	int x1 = std::numeric_limits<int>::min();
@@ -72,37 +88,6 @@ static cv::Rect2i get_toolpath_bounds(context_t &context) {
 	return cv::Rect2i(x0, y0, x1-x0, y1-y0);
 }
 
-static path_t path_translate(path_t path, int x, int y) {
-	for (auto &pt : path.points) {
-		pt.x += x;
-		pt.y += y;
-	}
-
-	return path;
-}
-
-static paths_t paths_translate(const paths_t &paths, int x, int y) {
-	paths_t r;
-	r.reserve(paths.size());
-
-	for (auto &path : paths)
-		r.emplace_back(path_translate(path, x, y));
-
-	return r;
-}
-
-static paths_t paths_replicate(const paths_t &paths, int nx, int ny, int dx, int dy) {
-	paths_t r;
-	r.reserve(paths.size()*nx*ny);
-
-	for (int ix=0; ix<nx; ix++)
-		for (int iy=0; iy<ny; iy++)
-			for (auto &path: paths)
-				r.emplace_back(path_translate(path, ix*dx, iy*dy));
-
-	return r;
-}
-
 static bool do_outputs_replication(context_t &context) {
 	auto opt = context.yaml["export-options"]["replicate"];
 	if (!opt.IsDefined())
@@ -131,60 +116,74 @@ static bool do_outputs_replication(context_t &context) {
 
 	DEBUG("Replicating layout grid " << rows << " rows by " << cols << " cols, with " << clearance << "mm of clearance...");
 
-	auto bounds_px = get_toolpath_bounds(context);
-	DEBUG("Toolpath bonds " << bounds_px  << "px");
+	auto bounds = get_toolpath_bounds(context);
+	DEBUG("Toolpath bounds " << double(bounds.width) / point_one << "x" << double(bounds.height) / point_one << "px");
 
-	int x_step = int(clearance * context.ppmm +.5) + bounds_px.width;
-	int y_step = int(clearance * context.ppmm +.5) + bounds_px.height;
+	int x_step = int(clearance * context.ppmm * point_one +.5) + bounds.width;
+	int y_step = int(clearance * context.ppmm * point_one +.5) + bounds.height;
 
-	job_tool_paths_t job_tool_paths;
-	for (auto &job_tool_paths : context.job_tool_paths)
-		for (auto &tool_paths : job_tool_paths.second)
-			tool_paths.second = paths_replicate(tool_paths.second, cols, rows, x_step, y_step);
+	// Paths stay those of one board, placed on each tile by output.
+	context.instances.clear();
+	for (unsigned ix=0; ix<cols; ix++)
+		for (unsigned iy=0; iy<rows; iy++)
+			context.instances.emplace_back(ix*x_step, iy*y_step);
 
 	// Fix bounds
-	context.bounds.width  += x_step*(cols-1) / context.ppmm;
-	context.bounds.height += y_step*(rows-1) / context.ppmm;
-	context.bounds.y      -= y_step*(rows-1) / context.ppmm;
-
-	return true;
-}
-
-bool do_outputs_rotation(context_t &context) {
-	auto angle = context.yaml["export-options"]["rotate"].as<double>(0.0)*M_PI/180;
-	if (!angle)
-		return true;
-
-	DEBUG("Rotating data points...");
-	double C = cos(angle);
-	double S = sin(angle);
-	auto rotate = [S,C](point_t &point) {
-		auto p = point;
-		point.x = C*p.x - S*p.y;
-		point.y = S*p.x + C*p.y;
-	};
-	for_all_points(context, rotate);
+	context.bounds.width  += x_step*(cols-1) / context.ppmm / point_one;
+	context.bounds.height += y_step*(rows-1) / context.ppmm / point_one;
+	context.bounds.y      -= y_step*(rows-1) / context.ppmm / point_one;
 
 	return true;
 }
 
-bool do_outputs_translation(context_t &context) {
-	auto opt = context.yaml["export-options"]["translate"];
+// Export options rotate and translate, as one affine transform, with the
+// bounds of everything as placed found in a single pass. Points are not moved,
+// so nothing is rounded and free areas still match.
+static bool do_outputs_transform(context_t &context) {
+	auto opt = context.yaml["export-options"];
 	if (!opt.IsDefined())
 		return true;
 
-	if (opt["zero"].as<std::string>("") == "lower-left") {
+	auto angle = opt["rotate"].as<double>(0.0)*M_PI/180;
+	if (angle) {
+		DEBUG("Rotating data points...");
+		double C = cos(angle);
+		double S = sin(angle);
+		context.transform = cv::Matx23d(C, -S, 0, S, C, 0);
+	}
+
+	auto translate = opt["translate"];
+	if (translate.IsDefined() && translate["zero"].as<std::string>("") == "lower-left") {
 		DEBUG("Translating points...");
 		// Find lower-left.
 		double x0 = +INFINITY, y0 = +INFINITY;
 		double x1 = -INFINITY, y1 = -INFINITY;
-		for_all_points(context, [&](point_t &p) {
-			x0 = std::fmin(x0, p.x);
-			x1 = std::fmax(x1, p.x);
-			y0 = std::fmin(y0, p.y);
-			y1 = std::fmax(y1, p.y);
+		for_all_points(context, [&](const point_t &p) {
+			cv::Point2d q = context.place(p);
+			x0 = std::fmin(x0, q.x);
+			x1 = std::fmax(x1, q.x);
+			y0 = std::fmin(y0, q.y);
+			y1 = std::fmax(y1, q.y);
 		});
 
+		// Over all tiles, which move along with the first.
+		if (!context.instances.empty()) {
+			double ox0 = +INFINITY, oy0 = +INFINITY;
+			double ox1 = -INFINITY, oy1 = -INFINITY;
+			cv::Point2d origin = context.place(cv::Point2d(0, 0));
+			for (auto &offset : context.instances) {
+				cv::Point2d o = context.place(offset) - origin;
+				ox0 = std::fmin(ox0, o.x);
+				ox1 = std::fmax(ox1, o.x);
+				oy0 = std::fmin(oy0, o.y);
+				oy1 = std::fmax(oy1, o.y);
+			}
+			x0 += ox0;
+			x1 += ox1;
+			y0 += oy0;
+			y1 += oy1;
+		}
+
 		// Add 10mm margin
 		x0 -= 10 * context.ppmm;
 		x1 += 10 * context.ppmm;
@@ -192,10 +191,8 @@ bool do_outputs_translation(context_t &context) {
 		y1 += 10 * context.ppmm;
 
 		// Move to reference
-		for_all_points(context, [&](point_t &p) {
-			p.x -= x0;
-			p.y -= y0;
-		});
+		context.transform(0, 2) -= x0;
+		context.transform(1, 2) -= y0;
 
 		// Patch bounds
 		context.bounds.x      =      0  / context.ppmm;
@@ -203,28 +200,285 @@ bool do_outputs_translation(context_t &context) {
 		context.bounds.y      =      0  / context.ppmm;
 		context.bounds.height = (y1-y0) / context.ppmm;
 	}
+
+	return true;
+}
+
+// Collects the paths selected by an output, by priority and tool. Panels
+// are flattened into paths for every tile, unless instanced.
+static metapaths_t do_outputs_collect(context_t &context, const YAML::Node &co, int tool_change_slack, bool instanced) {
+	// Start by merging paths
+	metapaths_t paths;
+	iterate_job_tool_paths(context.job_tool_paths,
+		[&](std::string job, std::string tool, paths_t &jtp) {
+		
+		// Filter
+		if (!output_filter_matches(job, tool, co["paths"]))
+			return;
+	
+		bool is_mill = context.tools[tool].type == tool_t::mill;
+		bool needs_predrill = !context.tools[tool].predrill.empty();
+
+		DEBUG("	" << jtp.size() << " paths from " << job << "/" << tool << ".");
+
+		auto free_area = context.free_areas.find(job);
+		const std::string *job_name = &context.job_tool_paths.find(job)->first;
+
+		for (auto &path : jtp) {
+			auto &points = path.points;
+			if (!points.size())
+				continue;
+
+			metapath_t mp;
+			mp.tool = &context.tools[tool];
+			mp.path = &path;
+			mp.job = job_name;
+			if (free_area != context.free_areas.end())
+				mp.free_area = &free_area->second;
+
+			mp.priority = context.yaml["jobs"][job]["priority"].as<int>(0)+ co["priority"].as<int>(0);
+			mp.priority += path.priority;
+
+			// TODO: fix reversible
+			mp.reversible = path.reversible;
+			mp.backwards = false;
+			if (mp.reversible) {
+				mp.entry = points.front();
+				mp.exit  = points.back();
+				mp.rentry = points.back();
+				mp.rexit  = points.front();
+			} else {
+				mp.entry = points.front();
+				mp.exit  = points.back();
+				mp.rentry = points.front();
+				mp.rexit  = points.back();
+			}
+
+			paths.push_back(mp);
+		}
+	});
+
+	if (!instanced && !context.instances.empty()) {
+		metapaths_t tiles;
+		tiles.reserve(paths.size() * context.instances.size());
+		for (auto &offset : context.instances) {
+			cv::Point2d o = offset;
+			for (auto mp : paths) {
+				mp.offset = offset;
+				mp.entry += o;
+				mp.exit += o;
+				mp.rentry += o;
+				mp.rexit += o;
+				tiles.push_back(mp);
+			}
+		}
+		paths = std::move(tiles);
+	}
+
+	if (paths.empty())
+		return paths;
+
+	// Simple sort by priority and tool diameter
+	std::sort(paths.begin(), paths.end(),
+		[](const metapath_t &a, const metapath_t &b) {
+			if (a.priority != b.priority)
+				return a.priority < b.priority;
+			if (a.tool->diameter != b.tool->diameter)
+				return a.tool->diameter < b.tool->diameter;
+			if (a.reversible != b.reversible)
+				return a.reversible < b.reversible;
+			return false;
+		}
+	);
+
+	// Then the fewest tool changes, as far as priorities allow.
+	auto changes = metapath_sort_tools(paths.begin(), paths.end(), context.tools, tool_change_slack);
+	DEBUG("	" << changes.second << " tool changes" << (changes.first != changes.second ? " (" + std::to_string(changes.first) + " by priority only)" : "") << ".");
+
+	return paths;
+}
+
+// Sorts collected paths within the time budget (s, 0 for none). Sorting
+// telemetry goes to csv, if given. Reads nothing but the machine from context,
+// so plans may be sorted concurrently.
+static void do_outputs_plan(
+	const context_t &context, metapaths_t &paths, const std::string &file,
+	const std::string &sort_mode, const std::string &sort_cost, uint64_t seed, size_t starts,
+	size_t cluster_size, double budget, std::ostream *csv
+) {
+	if (sort_mode == "none" || paths.empty())
+		return;
+
+	auto sort_groups = [&](const auto &cost) {
+		auto sorter = [&](metapaths_t::iterator begin, metapaths_t::iterator end, metapath_sort_state_t &state) {
+			size_t n = std::distance(begin, end);
+			if (sort_mode == "hilbert")
+				metapath_sort_hilbert(begin, end, cost);
+			else if (sort_mode == "greedy")
+				metapath_sort_greed_insert(begin, end, state, cost);
+			else if (sort_mode == "anneal" && begin->reversible && n > 3 && n <= 20000)
+				metapath_sort_anneal_reversal(begin, end, state, cost);
+			else {
+				auto local_search = [&](metapaths_t::iterator begin, metapaths_t::iterator end,
+						metapath_sort_state_t &state, const std::vector<size_t> &focus) {
+					if (sort_mode != "auto")
+						return;
+					metapath_sort_entries(begin, end, cost);
+					if (begin->reversible)
+						metapath_sort_2opt(begin, end, state, cost, focus);
+					else
+						metapath_sort_atsp(begin, end, state, cost, focus);
+				};
+
+				// Huge groups are split, and the parts sorted in parallel.
+				metapath_sort_clusters(begin, end, state, cluster_size,
+					[&](metapaths_t::iterator begin, metapaths_t::iterator end, metapath_sort_state_t &state) {
+						metapath_sort_nearest(begin, end, state, cost);
+						local_search(begin, end, state, {});
+					},
+					local_search, cost);
+			}
+
+			// Enter closed loops near where the previous path ends.
+			metapath_sort_entries(begin, end, cost);
+		};
+
+		// Priority and tool from previous sort must be respected, so data is segmented.
+		struct group_t {
+			metapaths_t::iterator begin, end;
+			size_t size;
+			metapath_sort_result_t result{};
+		};
+		std::vector<group_t> groups;
+		for (auto begin = paths.begin(); begin != paths.end(); ) {
+			// Pick a group with same priority, tool, and reversible-ness
+			auto middle = begin;
+			while (middle!=paths.end() && begin->priority == middle->priority && begin->tool == middle->tool && begin->reversible == middle->reversible)
+				middle++;
+			groups.push_back({begin, middle, size_t(std::distance(begin, middle))});
+			begin = middle;
+		}
+
+		// Groups are sorted in parallel, so they all get the whole time budget.
+		typedef metapath_sort_state_t::clock clock;
+		auto deadline = budget > 0 ?
+			clock::now() + std::chrono::duration_cast<clock::duration>(std::chrono::duration<double>(budget)) :
+			clock::time_point::max();
+
+		// Largest first, so the pool ends up busy with the small ones.
+		std::vector<size_t> order(groups.size());
+		for (size_t g=0; g<order.size(); g++)
+			order[g] = g;
+		std::stable_sort(order.begin(), order.end(), [&](size_t a, size_t b) {
+			return groups[a].size > groups[b].size;
+		});
+
+		std::vector<std::function<void()>> tasks;
+		for (size_t g : order) {
+			tasks.push_back([&, g] {
+				// Tiny groups have nothing to gain from more starts.
+				auto &group = groups[g];
+				group.result = metapath_sort_multistart(group.begin, group.end,
+					group.size > 3 ? starts : 1, seed, g, deadline, sorter, cost);
+			});
+		}
+		thread_pool_t::instance().run(std::move(tasks));
+
+		for (size_t g=0; g<groups.size(); g++) {
+			auto &group = groups[g];
+			auto &result = group.result;
+			auto &telemetry = result.telemetry;
+			std::string took = telemetry.size() >= 2 ?
+				" in " + std::to_string(telemetry.back().first) + "s" : "";
+			DEBUG("	Sorted " << group.size << " paths for " << file << " with priority " << group.begin->priority
+				<< " from " << result.starts << " starts, cost " << result.cost << " (worst " << result.worst << ")" << took << ".");
+			if (csv) {
+				for (auto &sample : telemetry)
+					*csv << file << "," << g << "," << group.size << "," << sample.first << "," << sample.second << "\n";
+			}
+		}
+	};
+
+	if (sort_cost == "machine")
+		sort_groups(machine_cost_t(context.machine, context.ppmm));
+	else
+		sort_groups(cost_cnc_modified_t());
+}
+
+// What a formatter may see of the context, on a thread of its own. The YAML
+// tree is cloned, as yaml-cpp nodes are not safe to read from several threads.
+// Paths are left out: metapaths point to those of the original context.
+// Tiles are only passed on to formatters that place them themselves.
+static context_t output_context(const context_t &context, bool instanced) {
+	context_t c;
+	c.fileName = context.fileName;
+	c.ppmm = context.ppmm;
+	c.bounds = context.bounds;
+	c.machine = context.machine;
+	c.inputs = context.inputs;
+	c.yaml = YAML::Clone(context.yaml);
+	c.dry_run = context.dry_run;
+	c.transform = context.transform;
+	if (instanced)
+		c.instances = context.instances;
+	return c;
 }
 
 bool do_outputs(context_t &context) {
 	// Translate and rotate all curves as required [TODO: Pre-alpha]
 	do_outputs_replication(context);
-	do_outputs_rotation(context);
-	do_outputs_translation(context);
+	do_outputs_transform(context);
+
+	// Sorting is random, but repeatable given the seed, so always log it.
+	uint64_t global_seed = context.yaml["seed"].as<uint64_t>(std::random_device{}());
+	DEBUG("Sorting seed is " << global_seed << ".");
+
+	// An output file, and how to write it.
+	struct output_t {
+		std::string file;
+		const formatter_table_entry_t *formatter;
+		bool mirror;
+		std::string eol;
+		int precision;
+		context_t context;
+	};
+
+	// Sorted paths, shared by outputs with the same paths and sorting options.
+	struct plan_t {
+		std::string file; // First output, for logs
+		std::string sort_mode, sort_cost;
+		uint64_t seed;
+		size_t starts, cluster_size;
+		double budget;
+		metapaths_t paths;
+		std::vector<output_t> outputs;
+		std::ostringstream telemetry;
+	};
+	std::vector<std::unique_ptr<plan_t>> plans; // In order of first output
+	std::map<std::string, plan_t *> plan_of;
+
+	// Cost vs. time of every sorted group, for tuning.
+	std::ofstream telemetry_csv;
+	if (context.yaml["debug"].as<bool>(false)) {
+		telemetry_csv.open("p2g-debug-out/sort-telemetry.csv");
+		telemetry_csv << "file,group,paths,seconds,cost\n";
+	}
 
-	DEBUG("Running output jobs...");
+	DEBUG("Planning output jobs...");
 	for (const auto &co : context.yaml["outputs"]) {
 		// Skip disabled outputs
 		if (!co["enabled"].as<bool>(true))
 			continue;
 
 		std::string file = co["file"].as<std::string>();
-		std::string file_ext = std::string(file, file.find_last_of('.'));
+		size_t dot = file.find_last_of('.');
+		std::string file_ext = dot == std::string::npos ? "" : file.substr(dot);
 		DEBUG("  For " << file << "...");
 		
 		std::string formatter_type = co["type"].as<std::string>("gcode");
 		const formatter_table_entry_t *formatter=0;
 		for (const auto &f : formatters) {
-			if (std::string(f.extensions).find(file_ext) != std::string::npos) {
+			if (!file_ext.empty() && std::string(f.extensions).find(file_ext) != std::string::npos) {
 				formatter = &f;
 			}
 			if (f.name == formatter_type) {
@@ -236,107 +490,121 @@ bool do_outputs(context_t &context) {
 			DEBUG("    Formatter " << formatter_type << " is unknown.");
 			continue;
 		}
+		if (context.dry_run && formatter->fcn != out_gcode) {
+			DEBUG("    Dry run, skipping " << formatter->name << ".");
+			continue;
+		}
 
 		// Safety check: Outputs must be under the same folder as config.
 		file = getRealPath(file);
 
-		// Start by merging paths
-		metapaths_t paths;
-		iterate_job_tool_paths(context.job_tool_paths,
-			[&](std::string job, std::string tool, paths_t &jtp) {
-			
-			// Filter
-			if (!output_filter_matches(job, tool, co["paths"]))
-				return;
-		
-			bool is_mill = context.tools[tool].type == tool_t::mill;
-			bool needs_predrill = !context.tools[tool].predrill.empty();
-
-			DEBUG("	" << jtp.size() << " paths from " << job << "/" << tool << ".");
-
-			for (auto &path : jtp) {
-				auto &points = path.points;
-				if (!points.size())
-					continue;
-
-				metapath_t mp;
-				mp.tool = &context.tools[tool];
-				mp.path = &path;
-
-				mp.priority = context.yaml["jobs"][job]["priority"].as<int>(0)+ co["priority"].as<int>(0);
-				mp.priority += path.priority;
-
-				// TODO: fix reversible
-				mp.reversible = path.reversible;
-				mp.backwards = false;
-				if (mp.reversible) {
-					mp.entry = points.front();
-					mp.exit  = points.back();
-					mp.rentry = points.back();
-					mp.rexit  = points.front();
-				} else {
-					mp.entry = points.front();
-					mp.exit  = points.back();
-					mp.rentry = points.front();
-					mp.rexit  = points.back();
-				}
-
-				paths.push_back(mp);
-			}
-		});
+		// Cost-based sorting: true/auto, false/none, or a specific sorter.
+		std::string sort_mode = co["sort"].as<std::string>(formatter->sort_by_default ? "auto" : "none");
+		if (sort_mode == "true")
+			sort_mode = "auto";
+		if (sort_mode == "false")
+			sort_mode = "none";
+		if (!std::set<std::string>{"none", "auto", "nearest", "hilbert", "anneal", "greedy"}.count(sort_mode))
+			throw error("Unknown sort mode " + sort_mode + " for " + file + ".");
+
+		uint64_t seed = co["seed"].as<uint64_t>(global_seed);
+		size_t starts = co["sort-starts"].as<size_t>(context.yaml["sort-starts"].as<size_t>(4));
+		if (sort_mode == "hilbert")
+			starts = 1; // Not random
+
+		// Travel cost: machine seconds if a machine is described, else pixels.
+		std::string sort_cost = co["sort-cost"].as<std::string>(
+			context.yaml["sort-cost"].as<std::string>(context.yaml["machine"].IsDefined() ? "machine" : "distance"));
+		if (sort_cost != "machine" && sort_cost != "distance")
+			throw error("Unknown sort cost " + sort_cost + " for " + file + ".");
+
+		// Groups larger than this are sorted as clusters of about this size.
+		size_t cluster_size = co["sort-cluster-size"].as<size_t>(context.yaml["sort-cluster-size"].as<size_t>(20000));
+
+		// Priorities closer than this may be swapped, to save tool changes.
+		int tool_change_slack = co["tool-change-slack"].as<int>(context.yaml["tool-change-slack"].as<int>(1));
+
+		// Seconds for all sorting of this output, 0 for no limit.
+		double budget = co["sort-time-budget"].as<double>(context.yaml["sort-time-budget"].as<double>(0));
+
+		// Panels as G-code subroutines, sorted once for all tiles.
+		std::string subroutines = context.yaml["subroutines"].as<std::string>("none");
+		if (!std::set<std::string>{"none", "oword", "m98"}.count(subroutines))
+			throw error("Unknown subroutines " + subroutines + ", must be none, oword or m98.");
+		bool instanced = !context.instances.empty() && formatter->fcn == out_gcode && subroutines != "none";
+
+		// Anything that changes which paths are picked, or their order, goes on the key.
+		std::string plan_key = (co["paths"].IsDefined() ? YAML::Dump(co["paths"]) : "") + "\n" +
+			std::to_string(co["priority"].as<int>(0)) + " " + std::to_string(tool_change_slack) + " " + sort_mode +
+			(instanced ? " instanced" : "");
+		if (sort_mode != "none")
+			plan_key += " " + sort_cost + " " + std::to_string(seed) + " " + std::to_string(starts) + " " + std::to_string(cluster_size) + " " + std::to_string(budget);
+
+		plan_t *&plan = plan_of[plan_key];
+		if (plan) {
+			DEBUG("	Reusing paths sorted for " << plan->file << ".");
+		} else {
+			plans.emplace_back(new plan_t);
+			plan = plans.back().get();
+			plan->file = file;
+			plan->sort_mode = sort_mode;
+			plan->sort_cost = sort_cost;
+			plan->seed = seed;
+			plan->starts = starts;
+			plan->cluster_size = cluster_size;
+			plan->budget = budget;
+			plan->paths = do_outputs_collect(context, co, tool_change_slack, instanced);
+		}
 
-		if (paths.empty()) {
+		if (plan->paths.empty()) {
 			DEBUG("	No paths found, skipping file.");
 			continue;
 		}
 
-		// Simple sort by priority and tool diameter
-		std::sort(paths.begin(), paths.end(),
-			[](const metapath_t &a, const metapath_t &b) {
-				if (a.priority != b.priority)
-					return a.priority < b.priority;
-				if (a.tool->diameter != b.tool->diameter)
-					return a.tool->diameter < b.tool->diameter;
-				if (a.reversible != b.reversible)
-					return a.reversible < b.reversible;
-				return false;
-			}
-		);
-
-		// Cost-based sorting
-		if (co["sort"].as<bool>(formatter->sort_by_default)) {
-			// Priority and tool from previous sort must be respected, so data is segmented.
-			auto begin = paths.begin();
-			auto end = paths.end();
-			while (begin != end) {
-				// Pick a group with same priority, tool, and reversible-ness
-				auto middle = begin;
-				while (middle!=end && begin->priority == middle->priority && begin->tool == middle->tool && begin->reversible == middle->reversible)
-					middle++;
-
-				// Simmulated annealing is better, but requires reversible paths, and is too slow for large node count.
-				size_t n = std::distance(begin, middle);
-				if (!begin->reversible || n > 20000)
-					metapath_sort_greed_insert(begin, middle);
-				else if (n > 3)
-					metapath_sort_anneal_reversal(begin, middle);
-
-				begin = middle;
-			}
-		}
-
 		bool mirror = co["side"].as<std::string>("bottom") == "bottom";
-		
-		DEBUG("	Generating " << formatter_type << (mirror ? " (mirrored)" : "") << "...");
-		std::vector<std::string> vs = formatter->fcn(context, paths, mirror);
-
-		if (vs.empty()) continue;
-
-		std::ofstream out(file, std::ios::out);
 		std::string eol = co["crlf"].as<bool>(false) ? "\r\n" : "\n";
-		for (auto s : vs) out << s << eol;
+		int precision = co["precision"].as<int>(context.yaml["precision"].as<int>(6));
+		plan->outputs.push_back({file, formatter, mirror, eol, precision, output_context(context, instanced)});
 	}
 
+	// Plans are sorted, then their outputs written, all in parallel. Tasks only
+	// read the paths and the machine.
+	std::mutex stdout_mutex;
+	std::vector<std::function<void()>> tasks;
+	for (auto &plan : plans) {
+		tasks.push_back([&, plan = plan.get()] {
+			do_outputs_plan(context, plan->paths, plan->file, plan->sort_mode, plan->sort_cost, plan->seed,
+				plan->starts, plan->cluster_size, plan->budget, telemetry_csv.is_open() ? &plan->telemetry : nullptr);
+
+			std::vector<std::function<void()>> writes;
+			for (auto &output : plan->outputs) {
+				writes.push_back([&, plan, out = &output] {
+					auto &output = *out;
+					// "-" streams to standard output, e.g. to a server, one output at a time.
+					std::unique_lock<std::mutex> lock(stdout_mutex, std::defer_lock);
+					std::unique_ptr<sink_t> sink;
+					if (context.dry_run) {
+						sink.reset(new null_sink_t);
+					} else if (output.file == "-") {
+						lock.lock();
+						sink.reset(new fd_sink_t(STDOUT_FILENO));
+					} else {
+						sink.reset(new file_sink_t(output.file));
+					}
+					writer_t writer(*sink, output.eol, output.precision);
+					output.formatter->fcn(output.context, plan->paths, output.mirror, writer);
+					writer.flush();
+					DEBUG("  " << (context.dry_run ? "Simulated " : "Wrote ") << output.formatter->name << (output.mirror ? " (mirrored)" : "") << " to " << output.file << ".");
+				});
+			}
+			thread_pool_t::instance().run(std::move(writes));
+		});
+	}
+	thread_pool_t::instance().run(std::move(tasks));
+
+	for (auto &plan : plans)
+		telemetry_csv << plan->telemetry.str();
+
 	return true;
 }
 
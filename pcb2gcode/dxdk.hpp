@@ -54,11 +54,20 @@
  * are both compile-time constants.
  * 
  * However since the time k is backward the signal for D will be negated.
+ *
+ * Both sums are kept running, so each new sample costs O(1): as samples
+ * age, sum(k*x[k]) grows by sum(x[k]), and the sample falling out of the
+ * window takes N*x with it. Sums are recomputed once per N samples, so
+ * rounding errors do not pile up.
  */
 template <unsigned N>
 class dxdk {
-	std::array<double, N> X;
-	double D;
+	std::array<double, N> X; // Ring buffer, X[next] is the oldest sample
+	unsigned next{0};
+	unsigned count{0};
+	double Sx{0};  // sum(x[k])
+	double Skx{0}; // sum(k*x[k])
+	double D{NAN};
 	
 	static constexpr double SS() {
 		double r = 0;
@@ -78,15 +87,29 @@ class dxdk {
 	
 public:
 	dxdk() {
-		for (auto &x : X) x = NAN;
+		for (auto &x : X) x = 0;
 	}
 	
+	// Adds a sample, returns the slope, or NAN until N samples were seen.
 	double operator () (double x) {
-		D = 0;
-		for (size_t i=0; i<X.size(); i++) {
-			D -= (A * i + B) * x;
-			std::swap(X[i], x);
+		double dropped = count == N ? X[next] : 0;
+		X[next] = x;
+		next = (next + 1) % N;
+		if (count < N)
+			count++;
+
+		Skx += Sx - N * dropped;
+		Sx += x - dropped;
+		if (!next) {
+			// X[N-1] is the newest sample, X[0] the oldest.
+			Sx = Skx = 0;
+			for (unsigned i=0; i<N; i++) {
+				Sx += X[i];
+				Skx += (N-1-i) * X[i];
+			}
 		}
+
+		D = count < N ? NAN : -(A * Skx + B * Sx);
 		return D;
 	}
 	
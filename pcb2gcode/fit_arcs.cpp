@@ -0,0 +1,154 @@
+#include <pcb2gcode.hpp>
+
+namespace {
+    using pcb2gcode::segment_t;
+    typedef cv::Point2d P;
+
+    double cross(P a, P b) {
+        return a.x * b.y - a.y * b.x;
+    }
+
+    double dist(P a, P b) {
+        return std::hypot(a.x - b.x, a.y - b.y);
+    }
+
+    // Least-squares circle fit (Kasa) over points [i,j].
+    // Returns false if they are (nearly) colinear.
+    bool fit_circle(const std::vector<P> &pts, size_t i, size_t j, P &center) {
+        // Work around the centroid, for numerical stability.
+        P m(0, 0);
+        for (size_t k=i; k<=j; k++)
+            m += pts[k];
+        m = m * (1.0 / (j-i+1));
+
+        double suu=0, svv=0, suv=0, suuu=0, svvv=0, suvv=0, svuu=0;
+        for (size_t k=i; k<=j; k++) {
+            double u = pts[k].x - m.x;
+            double v = pts[k].y - m.y;
+            suu += u*u;
+            svv += v*v;
+            suv += u*v;
+            suuu += u*u*u;
+            svvv += v*v*v;
+            suvv += u*v*v;
+            svuu += v*u*u;
+        }
+
+        double det = suu*svv - suv*suv;
+        if (std::fabs(det) < 1e-12 * (suu+svv) * (suu+svv))
+            return false;
+
+        double bu = (suuu + suvv) / 2;
+        double bv = (svvv + svuu) / 2;
+        center.x = m.x + (bu*svv - bv*suv) / det;
+        center.y = m.y + (bv*suu - bu*suv) / det;
+        return true;
+    }
+
+    struct arc_t : public segment_t {
+        double sagitta{0};
+    };
+
+    // Check if points [i,j] can be replaced by a single arc within tol.
+    bool fits_arc(const std::vector<P> &pts, size_t i, size_t j, double tol, arc_t &seg) {
+        P c;
+        if (!fit_circle(pts, i, j, c))
+            return false;
+
+        // Move the center onto the bisector of the chord, so both ends
+        // are exactly on the arc, as controllers check for that.
+        P a = pts[i], b = pts[j];
+        P mid = (a + b) * 0.5;
+        P n(a.y - b.y, b.x - a.x);
+        double nn = n.dot(n);
+        if (nn == 0)
+            return false;
+        c = mid + n * ((c - mid).dot(n) / nn);
+        double r = dist(c, a);
+
+        double sweep = 0;
+        double dir = 0;
+        for (size_t k=i+1; k<=j; k++) {
+            P u = pts[k-1] - c;
+            P v = pts[k] - c;
+
+            // Vertices and chord midpoints must stay close to the circle.
+            if (std::fabs(dist(pts[k], c) - r) > tol)
+                return false;
+            if (std::fabs(dist((pts[k-1] + pts[k]) * 0.5, c) - r) > tol)
+                return false;
+
+            // Must always turn the same way, without wrapping around.
+            double step = std::atan2(cross(u, v), u.dot(v));
+            if (step * dir < 0)
+                return false;
+            if (step != 0)
+                dir = step;
+            sweep += step;
+        }
+
+        // Half circles at most, so controllers never have to guess.
+        if (std::fabs(sweep) > M_PI)
+            return false;
+
+        seg.type = sweep > 0 ? segment_t::arc_ccw : segment_t::arc_cw;
+        seg.end = pts[j];
+        seg.center = c;
+        seg.sagitta = r * (1 - std::cos(std::fabs(sweep) / 2));
+        return true;
+    }
+}
+
+namespace pcb2gcode {
+
+// Replaces runs of short lines by circular arcs, where possible.
+// Output starts from (but does not include) the first point.
+segments_t fit_arcs(const std::vector<cv::Point2d> &pts, double tol) {
+    segments_t res;
+    size_t n = pts.size();
+    size_t i = 0;
+
+    while (i+1 < n) {
+        // Arcs need at least 4 points, else lines are just as short.
+        arc_t best;
+        size_t best_j = i;
+
+        // Grow the arc exponentially, then refine by bisection.
+        size_t lo = i+2, hi = n;
+        for (size_t len=3; i+len < n; len *= 2) {
+            arc_t seg;
+            if (!fits_arc(pts, i, i+len, tol, seg)) {
+                hi = i+len;
+                break;
+            }
+            best = seg;
+            best_j = lo = i+len;
+        }
+        if (best_j != i) {
+            while (hi - lo > 1) {
+                size_t mid = (lo + hi) / 2;
+                arc_t seg;
+                if (fits_arc(pts, i, mid, tol, seg)) {
+                    best = seg;
+                    best_j = lo = mid;
+                } else {
+                    hi = mid;
+                }
+            }
+        }
+
+        if (best_j != i && best.sagitta > tol) {
+            res.push_back(best);
+            i = best_j;
+            continue;
+        }
+
+        // Nearly straight runs are better left as lines.
+        for (size_t end = std::max(best_j, i+1); i < end; i++)
+            res.push_back({segment_t::line, pts[i+1]});
+    }
+
+    return res;
+}
+
+}
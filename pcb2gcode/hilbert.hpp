@@ -0,0 +1,60 @@
+#pragma once
+#include <pcb2gcode.hpp>
+#include <algorithm>
+
+namespace pcb2gcode {
+
+// Position of (x, y) along a Hilbert curve filling the 2^32 x 2^32 grid.
+inline uint64_t hilbert_key(uint32_t x, uint32_t y) {
+	uint64_t d = 0;
+	for (uint32_t s = uint32_t(1) << 31; s; s >>= 1) {
+		uint32_t rx = (x & s) ? 1 : 0;
+		uint32_t ry = (y & s) ? 1 : 0;
+		d += uint64_t(s) * s * ((3 * rx) ^ ry);
+
+		// Rotate the quadrant, so the curve below s starts and ends right.
+		if (!ry) {
+			if (rx) {
+				x = ~x;
+				y = ~y;
+			}
+			std::swap(x, y);
+		}
+	}
+	return d;
+}
+
+// Indexes of pts, in the order they are visited by a Hilbert curve filling
+// their bounding square. Nearby points end up mostly close on the order.
+inline std::vector<size_t> hilbert_order(const std::vector<cv::Point2d> &pts) {
+	size_t n = pts.size();
+	if (!n)
+		return {};
+
+	double x0 = +INFINITY, y0 = +INFINITY, x1 = -INFINITY, y1 = -INFINITY;
+	for (auto &p : pts) {
+		x0 = std::min(x0, p.x);
+		y0 = std::min(y0, p.y);
+		x1 = std::max(x1, p.x);
+		y1 = std::max(y1, p.y);
+	}
+
+	// Same scale on both axes, so the curve keeps distances isotropic.
+	double side = std::max(x1 - x0, y1 - y0);
+	double scale = side > 0 ? 4294967295.0 / side : 0;
+
+	std::vector<std::pair<uint64_t, size_t>> keys(n);
+	for (size_t i=0; i<n; i++) {
+		uint32_t x = (pts[i].x - x0) * scale;
+		uint32_t y = (pts[i].y - y0) * scale;
+		keys[i] = {hilbert_key(x, y), i};
+	}
+	std::sort(keys.begin(), keys.end());
+
+	std::vector<size_t> order(n);
+	for (size_t i=0; i<n; i++)
+		order[i] = keys[i].second;
+	return order;
+}
+
+}
@@ -54,6 +54,7 @@ bool job_alignment_holes(context_t &context, std::string jobName) {
     paths.emplace_back();
     paths.back().points.emplace_back(maxx, maxy);
 
+    pixels_to_points(paths);
     context.job_tool_paths[jobName][toolName] = paths;
 
     return true;
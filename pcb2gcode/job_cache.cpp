@@ -0,0 +1,280 @@
+#include <pcb2gcode.hpp>
+#include <algorithm>
+#include <filesystem>
+#include <fstream>
+#include <iomanip>
+#include <set>
+#include <sstream>
+#include <unistd.h>
+
+namespace pcb2gcode {
+
+/* Cache of job results, under p2g-cache/.
+ *
+ * Each entry holds the paths of one job, as a toolpath file, and its free
+ * area, if any, as a png. Entries are named by a hash of everything a job
+ * reads: its part of the config, the input layers and tools it names, ppmm
+ * and bounds. Old entries are removed, least recently used first, to keep
+ * the cache under `job-cache` MB. Several processes may share the cache.
+ */
+namespace {
+
+const char *cache_dir = "p2g-cache";
+
+// 64-bit FNV-1a.
+struct fnv1a_t {
+	uint64_t hash{0xcbf29ce484222325};
+
+	void add(const void *data, size_t size) {
+		auto p = (const uint8_t *)data;
+		for (size_t i=0; i<size; i++) {
+			hash ^= p[i];
+			hash *= 0x100000001b3;
+		}
+	}
+	template<class T>
+	void add(const T &v) {
+		static_assert(std::is_arithmetic_v<T>);
+		add(&v, sizeof(v));
+	}
+	void add(const std::string &s) {
+		add(s.size());
+		add(s.data(), s.size());
+	}
+	void add(const cv::Mat &m) {
+		add(m.rows);
+		add(m.cols);
+		add(m.type());
+		for (int r=0; r<m.rows; r++)
+			add(m.ptr(r), m.cols * m.elemSize());
+	}
+	void add(const tool_t &t) {
+		add(t.description);
+		add(int(t.type));
+		add(t.diameter);
+		add(t.angle);
+		add(t.speed);
+		add(t.feed);
+		add(t.plunge);
+		add(t.infeed);
+		add(t.depth);
+		add(t.climb);
+		add(t.runs);
+		add(t.overlap);
+		add(t.predrill);
+	}
+};
+
+// All scalars of a node, keys included: tools are keys on raw_import jobs.
+void scalars(const YAML::Node &node, std::set<std::string> &out) {
+	if (node.IsScalar()) {
+		out.insert(node.Scalar());
+	} else if (node.IsSequence()) {
+		for (const auto &n : node)
+			scalars(n, out);
+	} else if (node.IsMap()) {
+		for (const auto &kv : node) {
+			scalars(kv.first, out);
+			scalars(kv.second, out);
+		}
+	}
+}
+
+std::string entry_path(uint64_t key, const char *ext) {
+	std::ostringstream ss;
+	ss << cache_dir << "/" << std::hex << std::setw(16) << std::setfill('0') << key << ext;
+	return ss.str();
+}
+
+}
+
+// False if the job reads a file that cannot be read: it is not cached.
+bool job_cache_key(context_t &context, std::string jobName, uint64_t &key) {
+	fnv1a_t h;
+	h.add(std::string("p2g-job-2"));
+	h.add(context.ppmm);
+	h.add(context.bounds.x);
+	h.add(context.bounds.y);
+	h.add(context.bounds.width);
+	h.add(context.bounds.height);
+
+	const YAML::Node &job = context.yaml["jobs"][jobName];
+	h.add(YAML::Dump(job));
+
+	// Names are only taken as inputs or tools if they are one.
+	std::set<std::string> names;
+	scalars(job, names);
+	for (auto &name : names) {
+		auto input = context.inputs.find(name);
+		if (input != context.inputs.end() && !input->second.empty()) {
+			h.add(name);
+			h.add(input->second);
+		}
+
+		auto tool = context.tools.find(name);
+		if (tool != context.tools.end()) {
+			h.add(name);
+			h.add(tool->second);
+		}
+	}
+
+	// Files of raw_import jobs, found as the job finds them: by input
+	// name, or as a file name.
+	if (job["type"].as<std::string>("") == "raw_import") {
+		for (const auto &pathSpec : job["paths"]) {
+			std::string input_id = pathSpec.begin()->second.as<std::string>("");
+			std::string file = context.yaml["inputs"][input_id].as<std::string>(input_id);
+			std::ifstream in(file, std::ios::binary);
+			if (!in)
+				return false;
+			std::stringstream data;
+			data << in.rdbuf();
+			if (in.bad())
+				return false;
+			h.add(file);
+			h.add(data.str());
+		}
+	}
+
+	key = h.hash;
+	return true;
+}
+
+bool job_cache_load(context_t &context, std::string jobName, uint64_t key) {
+	namespace fs = std::filesystem;
+	std::string paths = entry_path(key, ".paths");
+	std::string area = entry_path(key, ".png");
+	if (!fs::exists(paths))
+		return false;
+
+	// Other processes may evict the entry meanwhile: that is a miss.
+	context_t entry;
+	cv::Mat free_area;
+	try {
+		load_toolpaths(entry, paths);
+		if (fs::exists(area)) {
+			free_area = cv::imread(area, cv::IMREAD_GRAYSCALE);
+			if (free_area.empty())
+				return false;
+		}
+	} catch (const error &e) {
+		DEBUG("  Cache entry " << paths << " unusable: " << e);
+		return false;
+	} catch (const std::exception &e) {
+		DEBUG("  Cache entry " << paths << " unusable: " << e.what());
+		return false;
+	}
+
+	// Saved under the name of the job that ran, which may differ.
+	auto &jtp = context.job_tool_paths[jobName];
+	jtp.clear();
+	if (!entry.job_tool_paths.empty())
+		jtp = std::move(entry.job_tool_paths.begin()->second);
+	if (!free_area.empty())
+		context.free_areas[jobName] = free_area;
+
+	// Recently used
+	std::error_code ec;
+	auto now = fs::file_time_type::clock::now();
+	fs::last_write_time(paths, now, ec);
+	fs::last_write_time(area, now, ec);
+	return true;
+}
+
+bool job_cache_store(context_t &context, std::string jobName, uint64_t key, size_t limit) {
+	namespace fs = std::filesystem;
+	auto jtp = context.job_tool_paths.find(jobName);
+	if (jtp == context.job_tool_paths.end())
+		return false;
+	std::error_code ec;
+	fs::create_directory(cache_dir, ec);
+	if (ec)
+		return false;
+
+	// Files are written under temporary names, unique to this process, and
+	// renamed into place: readers see whole entries or none. The free area
+	// goes first, as the paths file marks the entry. Any failure leaves the
+	// job not stored.
+	std::string tmp = ".tmp" + std::to_string(getpid());
+	auto area = context.free_areas.find(jobName);
+	if (area != context.free_areas.end()) {
+		std::string png = entry_path(key, (tmp + ".png").c_str());
+		if (!cv::imwrite(png, area->second)) {
+			fs::remove(png, ec);
+			return false;
+		}
+		fs::rename(png, entry_path(key, ".png"), ec);
+		if (ec) {
+			fs::remove(png, ec);
+			return false;
+		}
+	}
+
+	// Only the job's paths, and no tools: those come from the config.
+	context_t entry;
+	entry.ppmm = context.ppmm;
+	entry.bounds = context.bounds;
+	std::string paths = entry_path(key, (tmp + ".paths").c_str());
+	bool saved = true;
+	std::swap(entry.job_tool_paths[jobName], jtp->second);
+	try {
+		save_toolpaths(entry, paths);
+	} catch (const error &e) {
+		DEBUG("  Cache entry " << paths << " not stored: " << e);
+		saved = false;
+	} catch (...) {
+		std::swap(entry.job_tool_paths[jobName], jtp->second);
+		throw;
+	}
+	std::swap(entry.job_tool_paths[jobName], jtp->second);
+	if (saved)
+		fs::rename(paths, entry_path(key, ".paths"), ec);
+	if (!saved || ec) {
+		fs::remove(paths, ec);
+		return false;
+	}
+
+	// Evict least recently used entries, by name, with all their files.
+	// Temporary files are left to their writers, unless an hour old.
+	struct use_t {
+		fs::file_time_type time;
+		uintmax_t size{0};
+		std::vector<fs::path> files;
+	};
+	std::map<std::string, use_t> entries;
+	uintmax_t total = 0;
+	auto stale = fs::file_time_type::clock::now() - std::chrono::hours(1);
+	for (auto &f : fs::directory_iterator(cache_dir, ec)) {
+		if (!f.is_regular_file(ec))
+			continue;
+		auto time = f.last_write_time(ec);
+		auto size = f.file_size(ec);
+		if (ec)
+			continue; // Removed meanwhile
+		std::string stem = f.path().stem().string();
+		if (stem.find(".tmp") != std::string::npos) {
+			if (time < stale)
+				fs::remove(f.path(), ec);
+			continue;
+		}
+		auto &e = entries[stem];
+		e.time = e.files.empty() ? time : std::max(e.time, time);
+		e.size += size;
+		e.files.push_back(f.path());
+		total += size;
+	}
+	std::vector<use_t *> lru;
+	for (auto &e : entries)
+		lru.push_back(&e.second);
+	std::sort(lru.begin(), lru.end(), [](use_t *a, use_t *b) { return a->time < b->time; });
+	for (auto e : lru) {
+		if (total <= limit)
+			break;
+		for (auto &f : e->files)
+			fs::remove(f, ec);
+		total -= e->size;
+	}
+	return true;
+}
+
+}
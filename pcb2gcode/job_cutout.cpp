@@ -126,6 +126,7 @@ bool job_cutout(context_t &context, std::string jobName) {
     drawContours(cutouts, paths, -1, 64, tool.diameter*context.ppmm);
     DebugImageSave("cutout", cutouts);
 
+    pixels_to_points(paths);
     context.job_tool_paths[jobName][toolName] = paths;
 
     return true;
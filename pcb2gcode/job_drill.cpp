@@ -116,11 +116,12 @@ bool job_drill(context_t &context, std::string jobName) {
                     points.push_back(points.front());
             }
 
+            pixels_to_points(paths_here);
             std::move(paths_here.begin(), paths_here.end(), std::back_inserter(tool_paths[tools[t].name]));
         } else {
-            // Simple hole, append as a single-point path.
+            // Simple hole, append as a single-point path, centered between pixels.
             path_t path;
-            path.points.emplace_back(ellipse.center);
+            path.points.push_back(subpixel(ellipse.center));
             tool_paths[tools[t].name].push_back(path);
         }
     }
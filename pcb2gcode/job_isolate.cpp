@@ -37,6 +37,7 @@ bool job_isolate(context_t &context, std::string jobName) {
 	cv::Mat mRest = removable_copper_area(mEdge, context.ppmm);
 	mRest -= mCopper;
 	DebugImageSave("copper", mRest);
+	context.free_areas[jobName] = mRest.clone();
 
 	// Isolation paths:
 	tool_t *primary_tool=0;
@@ -142,6 +143,7 @@ bool job_isolate(context_t &context, std::string jobName) {
 		}
 	}
 
+	pixels_to_points(tool_paths);
 	context.job_tool_paths[jobName] = tool_paths;
 	return true;
 }
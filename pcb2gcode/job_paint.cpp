@@ -23,6 +23,9 @@ bool job_paint(context_t &context, std::string jobName) {
 		return false;
 	}
 
+	// Everything inside the area may be cut.
+	context.free_areas[jobName] = mArea.clone();
+
 	// Isolation paths:
 	tool_t *primary_tool=0;
 	DEBUG("  Isolation milling...");
@@ -75,6 +78,7 @@ bool job_paint(context_t &context, std::string jobName) {
 		}
 	}
 
+	pixels_to_points(tool_paths);
 	context.job_tool_paths[jobName] = tool_paths;
 	return true;
 }
@@ -37,12 +37,13 @@ bool job_raw_import(context_t &context, std::string jobName) {
 	tool_paths_t tool_paths;
 
 	// Raw coodinates are expected to be in mm, but internally we work in pixels.
-	// This will be used to convert points to internal representation
+	// This will be used to convert points to internal representation, which
+	// keeps them between pixels.
 	auto make_point = [&context](double x, double y) {
-		return point_t(
-			(+x - context.bounds.x) * context.ppmm + 0.5,
-			(-y + context.bounds.y + context.bounds.height) * context.ppmm + 0.5
-		);
+		return subpixel(cv::Point2d(
+			(+x - context.bounds.x) * context.ppmm,
+			(-y + context.bounds.y + context.bounds.height) * context.ppmm
+		));
 	};
 
 	// Paths:
@@ -190,6 +190,7 @@ bool job_voronoi(context_t &context, std::string jobName) {
         DebugImageSave("voronoi-paths", last);
     }
 
+    pixels_to_points(tool_paths);
     context.job_tool_paths[jobName] = tool_paths;
     return true;
 }
@@ -0,0 +1,38 @@
+#include <pcb2gcode.hpp>
+#include <yaml-cpp/yaml.h>
+
+namespace pcb2gcode {
+
+bool load_machine(context_t &context) {
+    machine_t &machine = context.machine;
+    auto opt = context.yaml["machine"];
+    if (!opt.IsDefined())
+        return true;
+
+    // Either a single value for all axes, or {x: ..., y: ..., z: ...}
+    auto get_axes = [](const YAML::Node &node, double *axes) {
+        if (!node.IsDefined())
+            return;
+        if (node.IsScalar()) {
+            axes[0] = axes[1] = axes[2] = node.as<double>();
+            return;
+        }
+        axes[0] = node["x"].as<double>(axes[0]);
+        axes[1] = node["y"].as<double>(axes[1]);
+        axes[2] = node["z"].as<double>(axes[2]);
+    };
+
+    get_axes(opt["velocity"], machine.velocity);
+    get_axes(opt["acceleration"], machine.acceleration);
+    machine.retract_time = opt["retract-time"].as<double>(machine.retract_time);
+    machine.tool_change_time = opt["tool-change-time"].as<double>(machine.tool_change_time);
+    machine.junction_deviation = opt["junction-deviation"].as<double>(machine.junction_deviation);
+
+    for (int i=0; i<3; i++)
+        if (machine.velocity[i] <= 0 || machine.acceleration[i] <= 0)
+            throw error("Machine velocity and acceleration must be positive.");
+
+    return true;
+}
+
+}
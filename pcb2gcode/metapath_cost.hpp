@@ -0,0 +1,52 @@
+#pragma once
+#include <pcb2gcode.hpp>
+
+namespace pcb2gcode {
+
+/* Travel cost policies.
+ *
+ * Sorters are templates over these, so the cost is inlined into their inner
+ * loops. Policies are called with path points (1/point_one px), and must be
+ * symmetric.
+ */
+
+// Legacy pixel distance, with a fixed pen-up penalty of 2000 px.
+struct cost_cnc_modified_t {
+	double operator()(const cv::Point2d &a, const cv::Point2d &b) const {
+		if (a == b)
+			return 0;
+
+		double dx = fabs(a.x - b.x) / point_one;
+		double dy = fabs(a.y - b.y) / point_one;
+		return 2000 + fmax(dx, dy) + 0.2*fmin(dx, dy);
+	}
+};
+
+// Seconds taken by the machine to lift, rapid to b, and plunge again.
+struct machine_cost_t {
+	machine_t machine;
+	double mmpp;
+
+	machine_cost_t(const machine_t &m, double ppmm) : machine(m), mmpp(1/ppmm/point_one) {}
+
+	double operator()(const cv::Point2d &a, const cv::Point2d &b) const {
+		if (a == b)
+			return 0;
+		return machine.retract_time + machine.rapid_time((a.x - b.x) * mmpp, (a.y - b.y) * mmpp);
+	}
+};
+
+// Travel cost of a sequence of paths, from each exit to the next entry.
+template<class Cost>
+inline double metapath_travel_cost(
+	metapaths_t::const_iterator begin,
+	metapaths_t::const_iterator end,
+	const Cost &cost
+) {
+	double c = 0;
+	for (auto it = begin; it != end && it+1 != end; it++)
+		c += cost(it->exit, (it+1)->entry);
+	return c;
+}
+
+}
@@ -0,0 +1,287 @@
+#pragma once
+#include <pcb2gcode.hpp>
+#include <pcb2gcode/metapath_cost.hpp>
+#include <pcb2gcode/metapath_sort_state.hpp>
+#include <pcb2gcode/point_grid.hpp>
+#include <deque>
+
+namespace pcb2gcode {
+
+/* Local search with 2-opt and Or-opt moves over a path group.
+ *
+ * The group is an open tour: travel into the first path and out of the last
+ * one is free. Candidate moves only join a path to one of its K nearest
+ * neighbours, and the travel change of each move is evaluated in O(1) from
+ * the few links it replaces.
+ *
+ * 2-opt reverses a run of paths, and flips each of them. This only keeps the
+ * inner links unchanged if the cost is symmetric, and is only done if all
+ * paths are reversible. Or-opt moves a run of up to 3 paths elsewhere, also
+ * reversed when allowed.
+ *
+ * Paths are visited from a work queue, shuffled at first, and re-queued when
+ * their links change, until no improving move is left or time runs out. The
+ * queue starts with all paths, or only with the focus paths if given (by
+ * index), e.g. around the seams of a tour made of parts. Neighbours are only
+ * searched for paths that are visited.
+ */
+template<class Cost = cost_cnc_modified_t>
+static void metapath_sort_2opt(
+	metapaths_t::iterator begin, metapaths_t::iterator end,
+	metapath_sort_state_t &state,
+	const Cost &cost = Cost(),
+	const std::vector<size_t> &focus = {}
+) {
+	const size_t none = point_grid_t::npos;
+	const size_t K = 6;
+	const double eps = 1e-9;
+	size_t n = std::distance(begin, end);
+	if (n < 3 || state.expired())
+		return;
+
+	bool reversible = std::all_of(begin, end, [](const metapath_t &mp) { return mp.reversible; });
+	double initial_cost = metapath_travel_cost(begin, end, cost);
+	double tour_cost = initial_cost;
+	state.record(tour_cost, true);
+	if (state.verbose)
+		DEBUG("    Optimizing " << n << " paths with priority " << begin->priority << "...");
+
+	// Tour, position of each path on it, and whether it runs reversed.
+	std::vector<size_t> t(n), pos(n);
+	std::vector<bool> rev(n, false);
+	for (size_t i=0; i<n; i++)
+		t[i] = pos[i] = i;
+
+	auto entry_of = [&](size_t i) -> const cv::Point2d & {
+		return rev[i] ? begin[i].rentry : begin[i].entry;
+	};
+	auto exit_of = [&](size_t i) -> const cv::Point2d & {
+		return rev[i] ? begin[i].rexit : begin[i].exit;
+	};
+	auto at = [&](size_t k) -> size_t {
+		return k < n ? t[k] : none; // k = -1 wraps around to none too
+	};
+	// Travel between a and b, none is the free start or end of the tour.
+	auto link = [&](size_t a, size_t b) -> double {
+		if (a == none || b == none)
+			return 0;
+		return cost(exit_of(a), entry_of(b));
+	};
+
+	// Neighbours: paths with an end near either end of each path.
+	std::vector<cv::Point2d> points(2*n);
+	std::vector<size_t> ids(2*n);
+	for (size_t i=0; i<n; i++) {
+		points[2*i]   = begin[i].entry;
+		points[2*i+1] = begin[i].exit;
+		ids[2*i] = 2*i;
+		ids[2*i+1] = 2*i+1;
+	}
+	point_grid_t grid(points, ids);
+	std::vector<uint32_t> nbr(2*K*n, uint32_t(none));
+	std::vector<bool> found(n, false);
+	auto neighbours = [&](size_t i) -> const uint32_t * {
+		uint32_t *list = &nbr[2*K*i];
+		if (found[i])
+			return list;
+		found[i] = true;
+		auto other = [i](size_t o) { return o/2 != i; };
+		size_t k = 0;
+		for (size_t id : {2*i, 2*i+1}) {
+			for (size_t o : grid.nearest_k(points[id], K, other)) {
+				// Closed paths have both ends together, so skip repeats.
+				if (std::find(list, list+k, uint32_t(o/2)) == list+k)
+					list[k++] = o/2;
+			}
+		}
+		return list;
+	};
+
+	std::deque<size_t> queue(t.begin(), t.end());
+	if (!focus.empty())
+		queue.assign(focus.begin(), focus.end());
+	state.shuffle(queue.begin(), queue.end());
+	std::vector<bool> queued(n, false);
+	for (size_t a : queue)
+		queued[a] = true;
+	auto requeue = [&](size_t a) {
+		if (a != none && !queued[a]) {
+			queued[a] = true;
+			queue.push_back(a);
+		}
+	};
+
+	// Reverses the run t[l..r], flipping every path on it.
+	auto reverse_run = [&](size_t l, size_t r) {
+		std::reverse(t.begin()+l, t.begin()+r+1);
+		for (size_t k=l; k<=r; k++) {
+			pos[t[k]] = k;
+			rev[t[k]] = !rev[t[k]];
+		}
+	};
+
+	// Gain of reversing t[l..r], for symmetric costs.
+	auto reverse_gain = [&](size_t l, size_t r) -> double {
+		size_t p = at(l-1), x = t[l], y = t[r], q = at(r+1);
+		double removed = link(p, x) + link(y, q);
+		double added =
+			(p == none ? 0 : cost(exit_of(p), exit_of(y))) +
+			(q == none ? 0 : cost(entry_of(x), entry_of(q)));
+		return removed - added;
+	};
+
+	// 2-opt: join a's exit to a neighbour's exit, or a's entry to a neighbour's entry.
+	auto try_2opt = [&](size_t a) -> bool {
+		size_t i = pos[a];
+		double best = eps;
+		size_t bl = 0, br = 0;
+		for (size_t k=0; k<2*K; k++) {
+			size_t c = neighbours(a)[k];
+			if (c == uint32_t(none))
+				continue;
+			size_t j = pos[c];
+			std::pair<size_t, size_t> runs[] = {
+				j > i ? std::make_pair(i+1, j) : std::make_pair(j+1, i), // exit-exit
+				j < i ? std::make_pair(j, i-1) : std::make_pair(i, j-1), // entry-entry
+			};
+			for (auto [l, r] : runs) {
+				if (l > r || r >= n)
+					continue;
+				double g = reverse_gain(l, r);
+				if (g > best) {
+					best = g;
+					bl = l;
+					br = r;
+				}
+			}
+		}
+		if (best == eps)
+			return false;
+
+		for (size_t d : {at(bl-1), t[bl], t[br], at(br+1)})
+			requeue(d);
+		reverse_run(bl, br);
+		tour_cost -= best;
+		return true;
+	};
+
+	// Or-opt: move a run of up to 3 paths, starting or ending at a, next to a neighbour.
+	auto try_oropt = [&](size_t a) -> bool {
+		size_t i = pos[a];
+		double best = eps;
+		size_t bl = 0, br = 0, bk = 0;
+		bool bflip = false;
+
+		for (size_t len=1; len<=3; len++) {
+			for (size_t l : {i, i+1-len}) {
+				size_t r = l+len-1;
+				if (l > i || r >= n)
+					continue;
+
+				size_t p = at(l-1), x = t[l], y = t[r], q = at(r+1);
+				double removed = link(p, x) + link(y, q) - link(p, q);
+				if (removed <= eps)
+					continue;
+
+				// Insertion spots are between t[k] and t[k+1], for k outside of [l-1, r].
+				auto try_spot = [&](size_t k) {
+					if (ptrdiff_t(k) >= ptrdiff_t(l)-1 && ptrdiff_t(k) <= ptrdiff_t(r))
+						return;
+					size_t u = at(k), v = at(k+1);
+					double kept = link(u, v);
+					double fwd = link(u, x) + link(y, v) - kept;
+					if (removed - fwd > best) {
+						best = removed - fwd;
+						bl = l; br = r; bk = k; bflip = false;
+					}
+					if (reversible) {
+						double bwd =
+							(u == none ? 0 : cost(exit_of(u), exit_of(y))) +
+							(v == none ? 0 : cost(entry_of(x), entry_of(v))) - kept;
+						if (removed - bwd > best) {
+							best = removed - bwd;
+							bl = l; br = r; bk = k; bflip = true;
+						}
+					}
+				};
+
+				for (size_t e : {x, y}) {
+					if (e == y && x == y)
+						break;
+					for (size_t k=0; k<2*K; k++) {
+						size_t c = neighbours(e)[k];
+						if (c == uint32_t(none))
+							continue;
+						try_spot(pos[c]);
+						try_spot(pos[c]-1);
+					}
+				}
+				try_spot(-1);
+				try_spot(n-1);
+			}
+		}
+		if (best == eps)
+			return false;
+
+		for (size_t d : {at(bl-1), t[bl], t[br], at(br+1), at(bk), at(bk+1)})
+			requeue(d);
+
+		// Rotate the run into place, then flip it if needed.
+		size_t len = br - bl + 1;
+		size_t lo, hi, nl;
+		if (bk+1 < bl) {
+			lo = bk+1;
+			hi = br;
+			std::rotate(t.begin()+lo, t.begin()+bl, t.begin()+br+1);
+			nl = lo;
+		} else {
+			lo = bl;
+			hi = bk;
+			std::rotate(t.begin()+bl, t.begin()+br+1, t.begin()+bk+1);
+			nl = bk+1-len;
+		}
+		for (size_t k=lo; k<=hi; k++)
+			pos[t[k]] = k;
+		if (bflip)
+			reverse_run(nl, nl+len-1);
+		tour_cost -= best;
+		return true;
+	};
+
+	size_t moves = 0, visits = 0;
+	bool expired = false;
+	while (!queue.empty()) {
+		if (!(visits++ % 256)) {
+			state.record(tour_cost);
+			if ((expired = state.expired()))
+				break;
+		}
+
+		size_t a = queue.front();
+		queue.pop_front();
+		queued[a] = false;
+
+		bool improved = reversible && try_2opt(a);
+		improved = try_oropt(a) || improved;
+		if (improved) {
+			moves++;
+			requeue(a);
+		}
+	}
+
+	// Apply the new order and directions.
+	metapaths_t sorted;
+	sorted.reserve(n);
+	for (size_t i : t) {
+		sorted.push_back(begin[i]);
+		if (rev[i])
+			sorted.back().reverse();
+	}
+	std::copy(sorted.begin(), sorted.end(), begin);
+
+	state.record(tour_cost, true);
+	if (state.verbose)
+		DEBUG("      " << moves << " improving moves, final cost is " << int(1000*tour_cost/initial_cost)/10.0 << "% of original" << (expired ? ", out of time." : "."));
+}
+
+}
@@ -1,29 +1,15 @@
 #pragma once
 #include <pcb2gcode.hpp>
+#include <pcb2gcode/metapath_cost.hpp>
+#include <pcb2gcode/metapath_sort_state.hpp>
 
 namespace pcb2gcode {
 
-static void metapath_sort_anneal_nodeswap(metapaths_t::iterator begin, metapaths_t::iterator end) {
+template<class Cost = cost_cnc_modified_t>
+static void metapath_sort_anneal_nodeswap(metapaths_t::iterator begin, metapaths_t::iterator end, metapath_sort_state_t &state, const Cost &travel = Cost()) {
     DEBUG("    Sorting for priority " << begin->priority << "...");
-    using std::max, std::abs, std::sqrt;
     auto cost = [&](int a, int b) {
-        double dx = (begin+a)->entry.x - (begin+b)->entry.x;
-        double dy = (begin+a)->entry.y - (begin+b)->entry.y;
-
-        // Euclidian
-//        return sqrt(dx*dx + dy*dy);
-
-        // Quasi-Euclidian
-//        return dx*dx + dy*dy;
-
-        // Manhattan
-//        return fabs(fdx) + abs(fdy);
-
-        // CNC
-//        return fmax(fabs(dx), (dy));
-
-        // CNC modified
-        return fmax(fabs(dx), fabs(dy)) + 0.3*fmin(abs(dx), abs(dy)) ;
+        return travel((begin+a)->exit, (begin+b)->entry);
     };
 
     size_t n = std::distance(begin, end);
@@ -33,19 +19,19 @@ static void metapath_sort_anneal_nodeswap(metapaths_t::iterator begin, metapaths
         for (size_t i=1; i<n; i++) {
             c += cost(i-1,i);
         }
-        return c + cost(0, n-1);
+        return c + cost(n-1, 0);
     };
 
     DEBUG("      Cost before: " << totalCost());
     size_t iterlimit = n*n*1000;
     size_t changedelay = n;
     for (size_t  i = 0; i < iterlimit; i++) {
-        size_t a = rand() * n / RAND_MAX;
-        size_t b = size_t(rand() * n * double(iterlimit-i) / iterlimit / RAND_MAX + 1) % n;
+        size_t a = state.below(n);
+        size_t b = size_t(state.uniform() * n * double(iterlimit-i) / iterlimit + 1) % n;
 
         double oldcost = cost(a,(a+1)%n) + cost((a+1)%n,(a+2)%n) + cost(b,(b+1)%n) + cost((b+1)%n,(b+2)%n);
         double newcost = cost(a,(b+1)%n) + cost((b+1)%n,(a+2)%n) + cost(b,(a+1)%n) + cost((a+1)%n,(b+2)%n);
-        if (newcost < oldcost || exp(-(newcost-oldcost) / i * iterlimit) >= double(rand()) / RAND_MAX) {
+        if (newcost < oldcost || exp(-(newcost-oldcost) / i * iterlimit) >= state.uniform()) {
             changedelay = n;
             std::swap(*(begin+(a+1)%n), *(begin+(b+1)%n));
         }
@@ -1,47 +1,17 @@
 #pragma once
 #include <pcb2gcode.hpp>
 #include <pcb2gcode/dxdk.hpp>
+#include <pcb2gcode/metapath_cost.hpp>
+#include <pcb2gcode/metapath_sort_hilbert.hpp>
+#include <pcb2gcode/metapath_sort_state.hpp>
 
 namespace pcb2gcode {
 
-double cost_cnc_modified(point_t a, point_t b) {
-	// Same point does not require pen-up.
-	if (a == b)
-		return 0;
-
-	double dx = fabs(a.x - b.x);
-	double dy = fabs(a.y - b.y);
-
-	// CNC modified
-	// 2000 (20mm) is the penalty for pen-up
-	return 2000 + fmax(dx, dy) + 0.2*fmin(dx,dy);
-};
-
-double cost_euclidian(point_t a, point_t b) {
-	double dx = a.x - b.x;
-	double dy = a.y - b.y;
-	return sqrt(dx*dx + dy*dy);
-};
-
-double paths_length(
-	metapaths_t::iterator begin,
-	metapaths_t::iterator end,
-	std::function<double(const point_t &a, const point_t &b)> cost = cost_euclidian
-) {
-	double length = 0;
-	while (begin != end) {
-		auto &points = begin->path->points;
-		for (size_t i=1; i < points.size(); i++) {
-			length += cost(points[i-1], points[i]);
-		}
-		begin++;
-	}
-	return length;
-}
-
+template<class Cost = cost_cnc_modified_t>
 static void metapath_sort_anneal_reversal(
 	metapaths_t::iterator begin, metapaths_t::iterator end,
-	std::function<double(const point_t &a, const point_t &b)> cost = cost_cnc_modified
+	metapath_sort_state_t &state,
+	const Cost &cost = Cost()
 ) {
 	using std::max, std::abs, std::sqrt;
 	size_t n = std::distance(begin, end);
@@ -54,7 +24,11 @@ static void metapath_sort_anneal_reversal(
 	};
 	double initial_cost = wasted_cost();
 
-	DEBUG("    Optimizing " << n << " paths with priority " << begin->priority << "...");
+	// Start from the Hilbert order, rather than untangling job order.
+	metapath_sort_hilbert(begin, end, cost);
+
+	if (state.verbose)
+		DEBUG("    Optimizing " << n << " paths with priority " << begin->priority << "...");
 	size_t iterlimit = 100000;
 	size_t changed = 1;
 
@@ -72,17 +46,30 @@ static void metapath_sort_anneal_reversal(
 		return oldcost / newcost;
 	};
 
+	// Annealing may make things worse for a while, so keep the best tour.
 	double tc = wasted_cost();
+	double best_cost = tc;
+	metapaths_t best(begin, end);
+	state.record(tc, true);
+
 	for (size_t i=0; i<iterlimit; i++) {
+		if (state.expired()) {
+			if (state.verbose) {
+				DEBUG("");
+				DEBUGL("      Out of time.");
+			}
+			break;
+		}
+
 		// Choose path cut point at random, favoring longer travels.
-		double cut_length = rand() * tc / RAND_MAX;
+		double cut_length = state.uniform() * tc;
 		size_t cut_index=0;
 		while (cut_length>0) {
 			size_t next = (cut_index + 1) % n;
 			cut_length -= cost(begin[cut_index].exit, begin[next].entry);
 			cut_index = next;
 		}
-		//cut_index = rand() % n;
+		//cut_index = state.below(n);
 
 		// Rotate so the chosen travel goes from [0] to [1].
 		std::rotate(begin, begin+cut_index, end);
@@ -94,7 +81,7 @@ static void metapath_sort_anneal_reversal(
 			if (!begin[i].reversible) break;
 
 			double gain = reverse_gain(1,i);
-			if (gain > 1 || heat * gain - 0.01 >= double(rand()) / RAND_MAX) {
+			if (gain > 1 || heat * gain - 0.01 >= state.uniform()) {
 				changed++;
 				path_reverse(1, i);
 			}
@@ -102,16 +89,28 @@ static void metapath_sort_anneal_reversal(
 
 		tc = wasted_cost();
 		double dtc = dtc_dk(tc);
+		state.record(tc);
+		if (tc < best_cost) {
+			best_cost = tc;
+			std::copy(begin, end, best.begin());
+		}
 
-		DEBUGL("      Annealing iteration " << i << "/" << iterlimit << ", heat " << heat << ", cost " << int(1000*tc/initial_cost)/10.0 << "%, change " << dtc << "...\x1B[K\r");
+		if (state.verbose)
+			DEBUGL("      Annealing iteration " << i << "/" << iterlimit << ", heat " << heat << ", cost " << int(1000*tc/initial_cost)/10.0 << "%, change " << dtc << "...\x1B[K\r");
 
-		if (!isnan(dtc) && dtc > -0.001) {
-			DEBUG("");
-			DEBUGL("      Cost stagnated over last " << dtc_dk.size() << " iterations.");
+		if (!isnan(dtc) && dtc > -1e-9 * tc) { // Relative, as cost units vary
+			if (state.verbose) {
+				DEBUG("");
+				DEBUGL("      Cost stagnated over last " << dtc_dk.size() << " iterations.");
+			}
 			break;
 		}
 	}
 	
+	if (tc > best_cost)
+		std::copy(best.begin(), best.end(), begin);
+	state.record(std::min(tc, best_cost), true);
+
 	// Move a non-optimizable pen up/down to the start of the list.
 	for (size_t i = 1; i < n; i++) {
 		if (cost(begin[i-1].exit, begin[i].entry) != 0) {
@@ -120,6 +119,8 @@ static void metapath_sort_anneal_reversal(
 		}
 	}
 	
+	if (!state.verbose)
+		return;
 	DEBUG("");
 	DEBUG("      Final cost is " << int(1000*wasted_cost()/initial_cost)/10.0 << "% of original.");
 }
@@ -0,0 +1,224 @@
+#pragma once
+#include <pcb2gcode.hpp>
+#include <pcb2gcode/metapath_cost.hpp>
+#include <pcb2gcode/metapath_sort_state.hpp>
+#include <pcb2gcode/point_grid.hpp>
+#include <deque>
+
+namespace pcb2gcode {
+
+/* Local search for groups of non-reversible paths.
+ *
+ * Travel from path a to path b goes from the exit of a to the entry of b, and
+ * is not the same backwards, so this is an open asymmetric TSP. Only moves that
+ * keep the direction of every run of paths are used: swapping two adjacent
+ * runs A and B, which replaces the three links around them (or-3opt).
+ *
+ *   ... p | A | B | r+1 ...   ->   ... p | B | A | r+1 ...
+ *
+ * Or-opt is the case of a short run, holding the visited path at either end,
+ * moved elsewhere. Candidate moves only create links from a path to one of
+ * the K paths entered nearest to its exit, or exited nearest to its entry.
+ *
+ * Paths are visited from a work queue, as in metapath_sort_2opt(), which
+ * also starts with the focus paths only, if given.
+ */
+template<class Cost = cost_cnc_modified_t>
+static void metapath_sort_atsp(
+	metapaths_t::iterator begin, metapaths_t::iterator end,
+	metapath_sort_state_t &state,
+	const Cost &cost = Cost(),
+	const std::vector<size_t> &focus = {}
+) {
+	const size_t none = point_grid_t::npos;
+	const size_t K = 6;
+	const double eps = 1e-9;
+	ptrdiff_t n = std::distance(begin, end);
+	if (n < 3 || state.expired())
+		return;
+
+	double initial_cost = metapath_travel_cost(begin, end, cost);
+	double tour_cost = initial_cost;
+	state.record(tour_cost, true);
+	if (state.verbose)
+		DEBUG("    Optimizing " << n << " directed paths with priority " << begin->priority << "...");
+
+	// Tour, and position of each path on it. Positions -1 and n are the free
+	// start and end of the tour.
+	std::vector<size_t> t(n), pos(n);
+	for (ptrdiff_t i=0; i<n; i++)
+		t[i] = pos[i] = i;
+
+	auto at = [&](ptrdiff_t k) -> size_t {
+		return k >= 0 && k < n ? t[k] : none;
+	};
+	auto link = [&](size_t a, size_t b) -> double {
+		if (a == none || b == none)
+			return 0;
+		return cost(begin[a].exit, begin[b].entry);
+	};
+
+	// Neighbours: paths entered near the exit of each path, then paths
+	// exited near its entry. Searched when first needed.
+	std::vector<cv::Point2d> points(2*n);
+	std::vector<size_t> entries(n), exits(n);
+	for (ptrdiff_t i=0; i<n; i++) {
+		points[2*i]   = begin[i].entry;
+		points[2*i+1] = begin[i].exit;
+		entries[i] = 2*i;
+		exits[i] = 2*i+1;
+	}
+	point_grid_t entry_grid(points, entries), exit_grid(points, exits);
+	std::vector<uint32_t> nbr(2*K*n, uint32_t(none));
+	std::vector<bool> found(n, false);
+	auto neighbours = [&](size_t i) -> const uint32_t * {
+		uint32_t *list = &nbr[2*K*i];
+		if (found[i])
+			return list;
+		found[i] = true;
+		auto other = [i](size_t o) { return o/2 != i; };
+		size_t k = 0;
+		for (size_t o : entry_grid.nearest_k(begin[i].exit, K, other))
+			list[k++] = o/2;
+		k = K;
+		for (size_t o : exit_grid.nearest_k(begin[i].entry, K, other))
+			list[k++] = o/2;
+		return list;
+	};
+	auto successors = [&](size_t a) { return neighbours(a); };
+	auto predecessors = [&](size_t a) { return neighbours(a) + K; };
+
+	std::deque<size_t> queue(t.begin(), t.end());
+	if (!focus.empty())
+		queue.assign(focus.begin(), focus.end());
+	state.shuffle(queue.begin(), queue.end());
+	std::vector<bool> queued(n, false);
+	for (size_t a : queue)
+		queued[a] = true;
+	auto requeue = [&](size_t a) {
+		if (a != none && !queued[a]) {
+			queued[a] = true;
+			queue.push_back(a);
+		}
+	};
+
+	// Best swap of runs t[p+1..q] and t[q+1..r] found so far.
+	double best = 0;
+	ptrdiff_t bp = 0, bq = 0, br = 0;
+	auto consider = [&](ptrdiff_t p, ptrdiff_t q, ptrdiff_t r) {
+		if (p < -1 || p >= q || q >= r || r >= n)
+			return;
+		size_t a = at(p), b = at(q), c = at(r);
+		size_t a1 = at(p+1), b1 = at(q+1), c1 = at(r+1);
+		double g =
+			link(a, a1) + link(b, b1) + link(c, c1) -
+			link(a, b1) - link(c, a1) - link(b, c1);
+		if (g > best) {
+			best = g;
+			bp = p; bq = q; br = r;
+		}
+	};
+
+	// Or-opt: move a run of up to 3 paths, starting or ending at a, between
+	// t[k] and t[k+1], next to a neighbour.
+	auto try_oropt = [&](ptrdiff_t i) {
+		for (ptrdiff_t len=1; len<=3; len++) {
+			for (ptrdiff_t l : {i, i+1-len}) {
+				ptrdiff_t r = l+len-1;
+				if (l < 0 || r >= n)
+					continue;
+
+				auto try_spot = [&](ptrdiff_t k) {
+					if (k > r)
+						consider(l-1, r, k);
+					else if (k < l-1)
+						consider(k, l-1, r);
+				};
+				for (size_t k=0; k<K; k++) {
+					size_t u = predecessors(t[l])[k];
+					if (u != uint32_t(none))
+						try_spot(pos[u]);
+					size_t v = successors(t[r])[k];
+					if (v != uint32_t(none))
+						try_spot(ptrdiff_t(pos[v])-1);
+				}
+				try_spot(-1);
+				try_spot(n-1);
+			}
+		}
+	};
+
+	// Or-3opt: with a at each of the three cuts, pick its new successor from
+	// its neighbours, then the remaining cut from the neighbours of the path
+	// that follows it.
+	auto try_or3opt = [&](ptrdiff_t i) {
+		size_t a = t[i];
+		for (size_t k=0; k<=K; k++) {
+			// k == K tries the free end of the tour.
+			size_t c = k < K ? successors(a)[k] : size_t(uint32_t(none));
+			ptrdiff_t j = c != uint32_t(none) ? pos[c] : n;
+
+			for (size_t m=0; m<=K; m++) {
+				size_t d = none;
+				if (m < K && i+1 < n && predecessors(t[i+1])[m] != uint32_t(none))
+					d = predecessors(t[i+1])[m];
+				else if (m < K)
+					continue;
+
+				// a = t[p]: a -> t[q+1], t[r] -> t[p+1], t[q] -> t[r+1].
+				if (j > i+1)
+					consider(i, j-1, d != none ? ptrdiff_t(pos[d]) : n-1);
+				// a = t[r]: a -> t[p+1], t[q] -> t[r+1].
+				if (j < i && d != none)
+					consider(j-1, pos[d], i);
+				// a = t[q]: a -> t[r+1], t[p] -> t[q+1].
+				if (j > i)
+					consider(d != none ? ptrdiff_t(pos[d]) : -1, i, j-1);
+			}
+		}
+	};
+
+	size_t moves = 0, visits = 0;
+	bool expired = false;
+	while (!queue.empty()) {
+		if (!(visits++ % 256)) {
+			state.record(tour_cost);
+			if ((expired = state.expired()))
+				break;
+		}
+
+		size_t a = queue.front();
+		queue.pop_front();
+		queued[a] = false;
+
+		best = eps;
+		try_oropt(pos[a]);
+		try_or3opt(pos[a]);
+		if (best == eps)
+			continue;
+
+		for (ptrdiff_t k : {bp, bp+1, bq, bq+1, br, br+1})
+			requeue(at(k));
+		requeue(a);
+
+		// Swap the runs, and renumber everything in between.
+		std::rotate(t.begin()+bp+1, t.begin()+bq+1, t.begin()+br+1);
+		for (ptrdiff_t k=bp+1; k<=br; k++)
+			pos[t[k]] = k;
+		tour_cost -= best;
+		moves++;
+	}
+
+	// Apply the new order.
+	metapaths_t sorted;
+	sorted.reserve(n);
+	for (size_t i : t)
+		sorted.push_back(begin[i]);
+	std::copy(sorted.begin(), sorted.end(), begin);
+
+	state.record(tour_cost, true);
+	if (state.verbose)
+		DEBUG("      " << moves << " improving moves, final cost is " << int(1000*tour_cost/initial_cost)/10.0 << "% of original" << (expired ? ", out of time." : "."));
+}
+
+}
@@ -0,0 +1,88 @@
+#pragma once
+#include <pcb2gcode.hpp>
+#include <pcb2gcode/metapath_cost.hpp>
+#include <pcb2gcode/metapath_sort_hilbert.hpp>
+#include <pcb2gcode/metapath_sort_state.hpp>
+#include <pcb2gcode/thread_pool.hpp>
+
+namespace pcb2gcode {
+
+/* Cluster first, route second, for huge path groups.
+ *
+ * Paths are put in Hilbert order, then cut into runs of about `size` paths.
+ * Each run is a compact cluster, and the curve already visits clusters in a
+ * good order. Clusters are sorted on their own, in parallel on the shared
+ * thread pool, with sort(begin, end, state).
+ *
+ * Reversible clusters are then flipped when that joins them better to the
+ * previous one, and the seams are repaired with
+ * stitch(begin, end, state, focus), given the paths next to each seam.
+ *
+ * Memory stays linear, and all but the stitching runs on every core.
+ */
+template<class Sorter, class Stitcher, class Cost = cost_cnc_modified_t>
+static void metapath_sort_clusters(
+	metapaths_t::iterator begin, metapaths_t::iterator end,
+	metapath_sort_state_t &state, size_t size,
+	Sorter sort, Stitcher stitch,
+	const Cost &cost = Cost()
+) {
+	const size_t seam = 16; // Paths on each side of a seam to start stitching from
+	size_t n = std::distance(begin, end);
+	size_t clusters = (n + size/2) / std::max<size_t>(size, 1);
+	if (clusters < 2) {
+		sort(begin, end, state);
+		return;
+	}
+
+	state.record(metapath_travel_cost(begin, end, cost), true);
+	metapath_sort_hilbert(begin, end, cost);
+	state.record(metapath_travel_cost(begin, end, cost), true);
+	if (state.verbose)
+		DEBUG("    Sorting " << n << " paths as " << clusters << " clusters...");
+
+	// Cluster c is [first[c], first[c+1]). Seeds are drawn up front, so
+	// results do not depend on scheduling.
+	std::vector<size_t> first(clusters+1);
+	std::vector<uint64_t> seeds(clusters);
+	for (size_t c=0; c<=clusters; c++)
+		first[c] = c * n / clusters;
+	for (auto &seed : seeds)
+		seed = state.rng();
+
+	std::vector<std::function<void()>> tasks;
+	for (size_t c=0; c<clusters; c++) {
+		tasks.push_back([&, c] {
+			metapath_sort_state_t cs(seeds[c]);
+			cs.verbose = false;
+			cs.started = state.started;
+			cs.deadline = state.deadline;
+			sort(begin + first[c], begin + first[c+1], cs);
+		});
+	}
+	thread_pool_t::instance().run(std::move(tasks));
+
+	// Flip reversible clusters to enter them near the previous exit.
+	for (size_t c=1; c<clusters; c++) {
+		auto cb = begin + first[c], ce = begin + first[c+1];
+		const cv::Point2d &from = cb[-1].exit;
+		if (!std::all_of(cb, ce, [](const metapath_t &mp) { return mp.reversible; }))
+			continue;
+		if (cost(from, ce[-1].rentry) < cost(from, cb->entry)) {
+			std::reverse(cb, ce);
+			for (auto it = cb; it != ce; it++)
+				it->reverse();
+		}
+	}
+	state.record(metapath_travel_cost(begin, end, cost), true);
+
+	std::vector<size_t> focus;
+	for (size_t c=1; c<clusters; c++)
+		for (size_t i = first[c] - std::min(seam, first[c] - first[c-1]); i < std::min(first[c] + seam, first[c+1]); i++)
+			focus.push_back(i);
+	stitch(begin, end, state, focus);
+
+	state.record(metapath_travel_cost(begin, end, cost), true);
+}
+
+}
@@ -0,0 +1,37 @@
+#pragma once
+#include <pcb2gcode.hpp>
+#include <pcb2gcode/metapath_cost.hpp>
+
+namespace pcb2gcode {
+
+/* Picks where to enter closed loops, on an already sorted group.
+ *
+ * Each loop is entered at its vertex closest to the previous exit. As loops
+ * also end there, choices are made in order. The first loop is kept as is,
+ * and so are non-reversible ones, e.g. mills entering at their predrill.
+ */
+template<class Cost = cost_cnc_modified_t>
+static void metapath_sort_entries(
+	metapaths_t::iterator begin, metapaths_t::iterator end,
+	const Cost &cost = Cost()
+) {
+	for (auto it = begin; it != end; it++) {
+		if (it == begin || !it->closed() || !it->reversible)
+			continue;
+
+		const cv::Point2d &from = (it-1)->exit;
+		auto &points = it->path->points;
+		size_t best = it->start;
+		double best_cost = cost(from, it->entry);
+		for (size_t i=0; i+1<points.size() && best_cost > 0; i++) {
+			double c = cost(from, points[i] + it->offset);
+			if (c < best_cost) {
+				best_cost = c;
+				best = i;
+			}
+		}
+		it->set_start(best);
+	}
+}
+
+}
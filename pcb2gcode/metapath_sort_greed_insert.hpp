@@ -1,29 +1,16 @@
 #pragma once
 #include <pcb2gcode.hpp>
+#include <pcb2gcode/metapath_sort_hilbert.hpp>
+#include <pcb2gcode/metapath_sort_state.hpp>
 
 namespace pcb2gcode {
 
-static void metapath_sort_greed_insert(metapaths_t::iterator begin, metapaths_t::iterator end) {
-    DEBUG("    Sorting for priority " << begin->priority << "...");
-    using std::max, std::abs, std::sqrt;
+template<class Cost = cost_cnc_modified_t>
+static void metapath_sort_greed_insert(metapaths_t::iterator begin, metapaths_t::iterator end, metapath_sort_state_t &state, const Cost &travel = Cost()) {
+    if (state.verbose)
+        DEBUG("    Sorting for priority " << begin->priority << "...");
     auto cost = [&](int a, int b) {
-        double dx = (begin+a)->entry.x - (begin+b)->entry.x;
-        double dy = (begin+a)->entry.y - (begin+b)->entry.y;
-
-        // Euclidian
-//        return sqrt(dx*dx + dy*dy);
-
-        // Quasi-Euclidian
-//        return dx*dx + dy*dy;
-
-        // Manhattan
-//        return fabs(fdx) + abs(fdy);
-
-        // CNC
-//        return fmax(fabs(dx), (dy));
-
-        // CNC modified
-        return fmax(fabs(dx), fabs(dy)) + 0.3*fmin(abs(dx), abs(dy)) ;
+        return travel((begin+a)->exit, (begin+b)->entry);
     };
 
     size_t n = std::distance(begin, end);
@@ -33,17 +20,29 @@ static void metapath_sort_greed_insert(metapaths_t::iterator begin, metapaths_t:
         for (size_t i=1; i<n; i++) {
             c += cost(i-1,i);
         }
-        return c + cost(0, n-1);
+        return c + cost(n-1, 0);
     };
 
-    DEBUG("      Cost before: " << totalCost());
+    if (state.verbose)
+        DEBUG("      Cost before: " << totalCost());
+
+    // Start from the Hilbert order, rotated at random so runs differ.
+    metapath_sort_hilbert(begin, end, travel);
+    std::rotate(begin, begin + state.below(n), end);
 
-    // Randomized initial conditon gives better results
-    std::random_shuffle(begin, end);
+    // Out of time, the rest is put back in Hilbert order.
+    bool expired = false;
+    auto out_of_time = [&](size_t g) {
+        if (!(g % 64)) {
+            state.record(totalCost());
+            expired = state.expired();
+        }
+        return expired;
+    };
 
     // Stage 1: Greed/selection
     size_t g = 1;
-    while (g < n*3/4) {
+    while (g < n*3/4 && !out_of_time(g)) {
         size_t bi = g;
         double bc = cost(g-1, g);
         for (size_t i=g+1; i<n; i++) {
@@ -61,7 +60,7 @@ static void metapath_sort_greed_insert(metapaths_t::iterator begin, metapaths_t:
     }
 
     // Stage 2: Insert
-    while (g < n-1) {
+    while (g < n-1 && !out_of_time(g)) {
         size_t bi = 1;
         double bc = cost(0, g) + cost(g,1) - cost(0,1);
         for (size_t i=1; i<g-1; i++) {
@@ -79,7 +78,11 @@ static void metapath_sort_greed_insert(metapaths_t::iterator begin, metapaths_t:
         g++;
     }
 
-    DEBUG("      Cost after: " << totalCost() << "\x1B[K");
+    if (expired)
+        metapath_sort_hilbert(begin+g, end, travel);
+    state.record(totalCost(), true);
+    if (state.verbose)
+        DEBUG("      Cost after: " << totalCost() << (expired ? ", out of time" : "") << "\x1B[K");
 }
 
 }
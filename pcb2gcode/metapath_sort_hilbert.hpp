@@ -0,0 +1,43 @@
+#pragma once
+#include <pcb2gcode.hpp>
+#include <pcb2gcode/hilbert.hpp>
+#include <pcb2gcode/metapath_cost.hpp>
+
+namespace pcb2gcode {
+
+/* Space-filling curve sorting, O(n log n).
+ *
+ * Paths are ordered by the position of their entries along a Hilbert curve,
+ * then reversible paths are flipped when that gets their entry closer to the
+ * previous exit. Tours are about 25% longer than nearest neighbour ones, but
+ * take milliseconds even for huge groups, and make a good start for the
+ * slower sorters.
+ */
+template<class Cost = cost_cnc_modified_t>
+static void metapath_sort_hilbert(
+	metapaths_t::iterator begin, metapaths_t::iterator end,
+	const Cost &cost = Cost()
+) {
+	size_t n = std::distance(begin, end);
+	if (n < 2)
+		return;
+
+	std::vector<cv::Point2d> entries(n);
+	for (size_t i=0; i<n; i++)
+		entries[i] = begin[i].entry;
+
+	metapaths_t sorted;
+	sorted.reserve(n);
+	for (size_t i : hilbert_order(entries)) {
+		sorted.push_back(begin[i]);
+		auto &mp = sorted.back();
+		if (mp.reversible && sorted.size() > 1) {
+			auto &prev = sorted[sorted.size()-2].exit;
+			if (cost(prev, mp.rentry) < cost(prev, mp.entry))
+				mp.reverse();
+		}
+	}
+	std::copy(sorted.begin(), sorted.end(), begin);
+}
+
+}
@@ -0,0 +1,88 @@
+#pragma once
+#include <pcb2gcode.hpp>
+#include <pcb2gcode/metapath_cost.hpp>
+#include <pcb2gcode/metapath_sort_state.hpp>
+#include <pcb2gcode/thread_pool.hpp>
+
+namespace pcb2gcode {
+
+// Seed for one sorter run, mixed from the user seed, group and start indexes.
+inline uint64_t metapath_sort_seed(uint64_t seed, uint64_t group, uint64_t start) {
+	// splitmix64 finalizer
+	auto mix = [](uint64_t z) {
+		z += 0x9e3779b97f4a7c15;
+		z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9;
+		z = (z ^ (z >> 27)) * 0x94d049bb133111eb;
+		return z ^ (z >> 31);
+	};
+	return mix(mix(mix(seed) ^ group) ^ start);
+}
+
+// Outcome of metapath_sort_multistart().
+struct metapath_sort_result_t {
+	size_t starts{1};
+	double cost{0};  // Of the tour kept
+	double worst{0}; // Of the worst start
+	std::vector<std::pair<double, double>> telemetry; // Of the tour kept
+};
+
+/* Runs a sorter from several independent starts, and keeps the cheapest tour.
+ *
+ * Each start sorts its own copy of the group, on the shared thread pool, with
+ * its own random engine. Engines are seeded from (seed, group, start) only, and
+ * ties go to the lowest start, so the result does not depend on thread count
+ * or scheduling. Sorters run quietly, as groups may be sorted concurrently.
+ *
+ * The sorter is called as sort(begin, end, state), and should return by the
+ * deadline.
+ */
+template<class Sorter, class Cost = cost_cnc_modified_t>
+static metapath_sort_result_t metapath_sort_multistart(
+	metapaths_t::iterator begin, metapaths_t::iterator end,
+	size_t starts, uint64_t seed, uint64_t group,
+	metapath_sort_state_t::clock::time_point deadline,
+	Sorter sort, const Cost &cost = Cost()
+) {
+	starts = std::max<size_t>(starts, 1);
+	std::vector<metapaths_t> tours(starts);
+	std::vector<double> costs(starts);
+	std::vector<std::vector<std::pair<double, double>>> telemetry(starts);
+
+	// One start is sorted in place.
+	auto run = [&](size_t s) {
+		metapath_sort_state_t state(metapath_sort_seed(seed, group, s));
+		state.verbose = false;
+		state.deadline = deadline;
+		if (starts > 1) {
+			tours[s].assign(begin, end);
+			sort(tours[s].begin(), tours[s].end(), state);
+			costs[s] = metapath_travel_cost(tours[s].begin(), tours[s].end(), cost);
+		} else {
+			sort(begin, end, state);
+			costs[s] = metapath_travel_cost(begin, end, cost);
+		}
+		telemetry[s] = std::move(state.telemetry);
+	};
+
+	if (starts == 1) {
+		run(0);
+	} else {
+		std::vector<std::function<void()>> tasks;
+		for (size_t s=0; s<starts; s++)
+			tasks.push_back([&run, s] { run(s); });
+		thread_pool_t::instance().run(std::move(tasks));
+	}
+
+	size_t best = std::min_element(costs.begin(), costs.end()) - costs.begin();
+	if (starts > 1)
+		std::copy(tours[best].begin(), tours[best].end(), begin);
+
+	metapath_sort_result_t r;
+	r.starts = starts;
+	r.cost = costs[best];
+	r.worst = *std::max_element(costs.begin(), costs.end());
+	r.telemetry = std::move(telemetry[best]);
+	return r;
+}
+
+}
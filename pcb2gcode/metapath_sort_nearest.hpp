@@ -0,0 +1,236 @@
+#pragma once
+#include <pcb2gcode.hpp>
+#include <pcb2gcode/hilbert.hpp>
+#include <pcb2gcode/metapath_cost.hpp>
+#include <pcb2gcode/metapath_sort_state.hpp>
+#include <pcb2gcode/point_grid.hpp>
+
+namespace pcb2gcode {
+
+/* Nearest neighbour sorting, for large or non-reversible path groups.
+ *
+ * Stage 1 builds the tour from a random path, by always jumping to the nearest
+ * untaken entry, also considering the reversed entry of reversible paths.
+ * Entries are kept on a uniform grid, so each step costs O(log n) on average.
+ *
+ * Stage 2 relocates single paths (reversing if allowed) next to one of their
+ * K nearest neighbours, while that reduces the travel cost. Paths are kept
+ * on a linked list, so each move is evaluated and applied in O(1).
+ *
+ * Past the deadline, stage 1 appends the untaken paths in Hilbert order,
+ * and stage 2 stops.
+ */
+template<class Cost = cost_cnc_modified_t>
+static void metapath_sort_nearest(
+	metapaths_t::iterator begin, metapaths_t::iterator end,
+	metapath_sort_state_t &state,
+	const Cost &cost = Cost()
+) {
+	const size_t none = point_grid_t::npos;
+	const size_t K = 6;
+	size_t n = std::distance(begin, end);
+	if (n < 2)
+		return;
+
+	double initial_cost = metapath_travel_cost(begin, end, cost);
+	state.record(initial_cost, true);
+	if (state.verbose) {
+		DEBUG("    Nearest-neighbour sorting " << n << " paths with priority " << begin->priority << "...");
+		DEBUG("      Cost before: " << initial_cost);
+	}
+
+	// Point 2*i is the entry of path i, 2*i+1 is its reversed entry.
+	std::vector<cv::Point2d> points(2*n);
+	std::vector<size_t> ids;
+	ids.reserve(2*n);
+	for (size_t i=0; i<n; i++) {
+		points[2*i]   = begin[i].entry;
+		points[2*i+1] = begin[i].rentry;
+		ids.push_back(2*i);
+		if (begin[i].reversible)
+			ids.push_back(2*i+1);
+	}
+
+	std::vector<bool> rev(n, false);
+	auto entry_of = [&](size_t i, bool r) -> const cv::Point2d & {
+		return r ? begin[i].rentry : begin[i].entry;
+	};
+	auto exit_of = [&](size_t i, bool r) -> const cv::Point2d & {
+		return r ? begin[i].rexit : begin[i].exit;
+	};
+
+	// Stage 1: Nearest neighbour construction
+	std::vector<size_t> order;
+	order.reserve(n);
+	if (true) {
+		point_grid_t grid(points, ids);
+		size_t built = grid.size();
+
+		auto take = [&](size_t id) {
+			size_t i = id / 2;
+			order.push_back(i);
+			rev[i] = id & 1;
+			grid.remove(2*i);
+			grid.remove(2*i+1);
+		};
+
+		take(ids[state.below(ids.size())]);
+		while (order.size() < n) {
+			// Searches get slow as the grid empties, so rebuild it now and then.
+			if (grid.size() < built/4) {
+				grid = point_grid_t(points, grid.ids());
+				built = grid.size();
+			}
+
+			// Out of time: finish with a quick order.
+			if (!(order.size() % 1024) && state.expired()) {
+				std::vector<size_t> rest;
+				std::vector<cv::Point2d> entries;
+				for (size_t id : grid.ids()) {
+					if (id & 1)
+						continue;
+					rest.push_back(id / 2);
+					entries.push_back(points[id]);
+				}
+				for (size_t k : hilbert_order(entries))
+					order.push_back(rest[k]);
+				break;
+			}
+
+			size_t last = order.back();
+			take(grid.nearest(exit_of(last, rev[last])));
+		}
+	}
+
+	// Stage 2: Neighbour-limited relocation, unless already out of time.
+	bool expired = state.expired();
+	std::vector<size_t> next(n, none), prev(n, none);
+	for (size_t k=1; k<n; k++) {
+		next[order[k-1]] = order[k];
+		prev[order[k]] = order[k-1];
+	}
+	size_t head = order[0];
+	order.clear();
+
+	// Travel cost is tracked as moves are made, for telemetry.
+	double tour_cost = 0;
+	for (size_t i=head; next[i] != none; i = next[i])
+		tour_cost += cost(exit_of(i, rev[i]), entry_of(next[i], rev[next[i]]));
+	state.record(tour_cost, true);
+
+	// Neighbours: paths that may start near where each path ends, either way.
+	std::vector<uint32_t> nbr(expired ? 0 : 2*K*n, uint32_t(none));
+	if (!expired) {
+		point_grid_t grid(points, ids);
+		for (size_t i=0; i<n; i++) {
+			if (!(i % 1024) && (expired = state.expired()))
+				break;
+			auto other = [i](size_t id) { return id/2 != i; };
+			size_t k = 0;
+			for (size_t id : grid.nearest_k(begin[i].exit, K, other))
+				nbr[2*K*i + k++] = id/2;
+			if (begin[i].reversible)
+				for (size_t id : grid.nearest_k(begin[i].rexit, K, other))
+					nbr[2*K*i + k++] = id/2;
+		}
+	}
+
+	// Travel between a and b, none is the start or end of the group.
+	auto link = [&](size_t a, size_t b) -> double {
+		if (a == none || b == none)
+			return 0;
+		return cost(exit_of(a, rev[a]), entry_of(b, rev[b]));
+	};
+
+	// Moves p to the best position near its neighbours. True if moved.
+	auto relocate = [&](size_t p, std::vector<size_t> &dirty) -> bool {
+		size_t a = prev[p], b = next[p];
+		double removed = link(a, p) + link(p, b) - link(a, b);
+
+		double best_gain = 1e-9;
+		size_t best_q = none, best_s = none;
+		bool best_r = rev[p];
+		for (size_t k=0; k<2*K; k++) {
+			size_t r = nbr[2*K*p + k];
+			if (r == uint32_t(none))
+				continue;
+
+			// Try both before and after the neighbour.
+			std::pair<size_t, size_t> spots[] = { {prev[r], r}, {r, next[r]} };
+			for (auto [q, s] : spots) {
+				if (q == p || s == p)
+					continue;
+				double kept = link(q, s);
+				for (bool o : {false, true}) {
+					if (o && !begin[p].reversible)
+						continue;
+					double added =
+						(q == none ? 0 : cost(exit_of(q, rev[q]), entry_of(p, o))) +
+						(s == none ? 0 : cost(exit_of(p, o), entry_of(s, rev[s]))) - kept;
+					if (removed - added > best_gain) {
+						best_gain = removed - added;
+						best_q = q;
+						best_s = s;
+						best_r = o;
+					}
+				}
+			}
+		}
+
+		if (best_q == none && best_s == none)
+			return false;
+
+		// Unlink
+		if (a != none) next[a] = b; else head = b;
+		if (b != none) prev[b] = a;
+
+		// Relink
+		rev[p] = best_r;
+		prev[p] = best_q;
+		next[p] = best_s;
+		if (best_q != none) next[best_q] = p; else head = p;
+		if (best_s != none) prev[best_s] = p;
+
+		for (size_t d : {p, a, b, best_q, best_s})
+			if (d != none)
+				dirty.push_back(d);
+		tour_cost -= best_gain;
+		return true;
+	};
+
+	std::vector<size_t> todo(n), dirty;
+	for (size_t i=0; i<n; i++)
+		todo[i] = i;
+	size_t moves = 0;
+	while (!todo.empty() && moves < 16*n && !expired) {
+		dirty.clear();
+		for (size_t k=0; k<todo.size(); k++) {
+			if (!(k % 1024)) {
+				state.record(tour_cost);
+				if ((expired = state.expired()))
+					break;
+			}
+			if (relocate(todo[k], dirty))
+				moves++;
+		}
+		std::sort(dirty.begin(), dirty.end());
+		dirty.erase(std::unique(dirty.begin(), dirty.end()), dirty.end());
+		std::swap(todo, dirty);
+	}
+
+	// Apply the new order and directions.
+	metapaths_t sorted;
+	sorted.reserve(n);
+	for (size_t i=head; i != none; i = next[i]) {
+		sorted.push_back(begin[i]);
+		if (rev[i])
+			sorted.back().reverse();
+	}
+	std::copy(sorted.begin(), sorted.end(), begin);
+
+	state.record(tour_cost, true);
+	if (state.verbose)
+		DEBUG("      Cost after: " << tour_cost << " (" << moves << " relocations" << (expired ? ", out of time" : "") << ")");
+}
+
+}
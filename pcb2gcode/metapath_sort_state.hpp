@@ -0,0 +1,59 @@
+#pragma once
+#include <pcb2gcode.hpp>
+#include <chrono>
+#include <random>
+
+namespace pcb2gcode {
+
+// Per-run state of the path sorters. Concurrent runs each own one.
+struct metapath_sort_state_t {
+	typedef std::chrono::steady_clock clock;
+
+	std::mt19937_64 rng;
+	bool verbose{true}; // Report progress with DEBUG
+
+	// Sorters stop improving once past the deadline, and return what they have.
+	clock::time_point started{clock::now()};
+	clock::time_point deadline{clock::time_point::max()};
+
+	// Cost vs. time samples, as (seconds since started, cost).
+	std::vector<std::pair<double, double>> telemetry;
+
+	explicit metapath_sort_state_t(uint64_t seed=0) : rng(seed) { }
+
+	bool expired() const {
+		return clock::now() >= deadline;
+	}
+
+	double elapsed() const {
+		return std::chrono::duration<double>(clock::now() - started).count();
+	}
+
+	// Samples the cost, at most every 10ms unless forced.
+	void record(double cost, bool force=false) {
+		double t = elapsed();
+		if (force || telemetry.empty() || t - telemetry.back().first >= 0.01)
+			telemetry.emplace_back(t, cost);
+	}
+
+	// Random numbers are drawn by hand, as the <random> distributions
+	// differ between standard libraries, and results should not.
+
+	// Uniform on [0, 1)
+	double uniform() {
+		return (rng() >> 11) * 0x1.0p-53;
+	}
+
+	// Uniform on [0, n)
+	size_t below(size_t n) {
+		return rng() % n;
+	}
+
+	template<class It>
+	void shuffle(It begin, It end) {
+		for (size_t n = std::distance(begin, end); n > 1; n--)
+			std::iter_swap(begin + (n-1), begin + below(n));
+	}
+};
+
+}
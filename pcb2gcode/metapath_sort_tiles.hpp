@@ -0,0 +1,46 @@
+#pragma once
+#include <pcb2gcode.hpp>
+#include <pcb2gcode/metapath_cost.hpp>
+#include <pcb2gcode/metapath_sort_atsp.hpp>
+#include <pcb2gcode/metapath_sort_nearest.hpp>
+#include <pcb2gcode/metapath_sort_state.hpp>
+
+namespace pcb2gcode {
+
+/* Order of the tiles of a panel, for a run of paths cut on every tile.
+ *
+ * The run is entered at `entry` and left at `exit`, in tile coordinates, so
+ * each tile is a non-reversible path from entry to exit plus its offset. Only
+ * those are sorted, by nearest neighbour and then as an asymmetric TSP, never
+ * the paths of the run. Returns indexes into offsets, in cutting order.
+ */
+template<class Cost = cost_cnc_modified_t>
+static std::vector<size_t> metapath_sort_tiles(
+	const std::vector<point_t> &offsets, cv::Point2d entry, cv::Point2d exit,
+	const Cost &cost = Cost(), uint64_t seed = 0
+) {
+	metapaths_t tiles;
+	tiles.reserve(offsets.size());
+	for (auto &offset : offsets) {
+		cv::Point2d o = offset;
+		metapath_t mp;
+		mp.reversible = false;
+		mp.offset = offset;
+		mp.entry = mp.rentry = entry + o;
+		mp.exit = mp.rexit = exit + o;
+		tiles.push_back(mp);
+	}
+
+	metapath_sort_state_t state(seed);
+	state.verbose = false;
+	metapath_sort_nearest(tiles.begin(), tiles.end(), state, cost);
+	metapath_sort_atsp(tiles.begin(), tiles.end(), state, cost);
+
+	std::vector<size_t> order;
+	order.reserve(tiles.size());
+	for (auto &tile : tiles)
+		order.push_back(std::find(offsets.begin(), offsets.end(), tile.offset) - offsets.begin());
+	return order;
+}
+
+}
@@ -0,0 +1,176 @@
+#pragma once
+#include <pcb2gcode.hpp>
+#include <functional>
+#include <unordered_map>
+
+namespace pcb2gcode {
+
+/* Orders blocks of paths, those with the same priority and tool, for the
+ * fewest tool changes. Paths must come sorted by priority, and the order of
+ * paths within a block is kept.
+ *
+ * Block a must run before block b if:
+ *   - Both use the same tool, and a has the lower priority, e.g. inner
+ *     cutouts before outer ones.
+ *   - The tool of a predrills for the tool of b, and a's priority is not
+ *     higher.
+ *   - The priority of b is at least `slack` above that of a. With slack 1
+ *     all priorities are kept, and only tools of the same priority move.
+ *
+ * Running an available block of the current tool never costs a change, so it
+ * is always done first. Otherwise all choices of the next tool are searched
+ * (memoized) for up to 16 blocks, else the first available block is taken.
+ * Ties keep the given order.
+ *
+ * Returns the number of tool changes, before and after.
+ */
+static std::pair<size_t, size_t> metapath_sort_tools(
+	metapaths_t::iterator begin, metapaths_t::iterator end,
+	const tool_map_t &tools, int slack = 1
+) {
+	const size_t none = -1;
+
+	// Tools by order of appearance.
+	std::vector<const tool_t *> tool_list;
+	auto tool_index = [&](const tool_t *tool) -> size_t {
+		size_t t = std::find(tool_list.begin(), tool_list.end(), tool) - tool_list.begin();
+		if (t == tool_list.size())
+			tool_list.push_back(tool);
+		return t;
+	};
+
+	struct block_t {
+		int priority;
+		size_t tool;
+		metapaths_t paths;
+	};
+	std::vector<block_t> blocks;
+	std::map<std::pair<int, size_t>, size_t> block_of;
+	size_t changes_before = 0;
+	size_t last = none;
+	for (auto it = begin; it != end; it++) {
+		size_t t = tool_index(it->tool);
+		if (last != none && t != last)
+			changes_before++;
+		last = t;
+
+		auto key = std::make_pair(it->priority, t);
+		auto b = block_of.find(key);
+		if (b == block_of.end()) {
+			b = block_of.emplace(key, blocks.size()).first;
+			blocks.push_back({it->priority, t, {}});
+		}
+		blocks[b->second].paths.push_back(*it);
+	}
+
+	// Predecessors of each block.
+	size_t n = blocks.size();
+	auto predrills = [&](size_t a, size_t b) {
+		auto &name = tool_list[blocks[b].tool]->predrill;
+		auto p = tools.find(name);
+		return !name.empty() && p != tools.end() && &p->second == tool_list[blocks[a].tool];
+	};
+	std::vector<std::vector<size_t>> preds(n);
+	for (size_t a=0; a<n; a++) {
+		for (size_t b=0; b<n; b++) {
+			auto &A = blocks[a], &B = blocks[b];
+			if (a == b || A.priority > B.priority)
+				continue;
+			if ((A.tool == B.tool && A.priority < B.priority) ||
+				B.priority - A.priority >= slack || predrills(a, b))
+				preds[b].push_back(a);
+		}
+	}
+
+	std::vector<bool> done(n, false);
+	auto available = [&](size_t b) {
+		return !done[b] && std::all_of(preds[b].begin(), preds[b].end(), [&](size_t a) { return done[a]; });
+	};
+
+	// Fewest changes to run all blocks not done yet, after tool `last`, and
+	// the block to run next. Blocks are marked done while searching.
+	const size_t unsolvable = std::numeric_limits<size_t>::max() / 2;
+	std::unordered_map<uint64_t, std::pair<size_t, size_t>> memo;
+	std::function<std::pair<size_t, size_t>(uint64_t, size_t)> solve = [&](uint64_t mask, size_t last) -> std::pair<size_t, size_t> {
+		if (mask == (uint64_t(1) << n) - 1)
+			return {0, none};
+		uint64_t key = mask * (tool_list.size() + 1) + (last == none ? tool_list.size() : last);
+		auto m = memo.find(key);
+		if (m != memo.end())
+			return m->second;
+
+		std::pair<size_t, size_t> best{unsolvable, none};
+		auto run = [&](size_t b) {
+			done[b] = true;
+			size_t cost = (last != none && blocks[b].tool != last) + solve(mask | uint64_t(1) << b, blocks[b].tool).first;
+			done[b] = false;
+			if (cost < best.first)
+				best = {cost, b};
+		};
+
+		// Staying on the tool is free. Else try the first block of each tool,
+		// as the rest of that tool follows for free.
+		auto same = std::find_if(blocks.begin(), blocks.end(), [&](const block_t &block) {
+			size_t b = &block - blocks.data();
+			return block.tool == last && available(b);
+		});
+		if (same != blocks.end()) {
+			run(same - blocks.begin());
+		} else {
+			std::vector<bool> tried(tool_list.size(), false);
+			for (size_t b=0; b<n; b++) {
+				if (available(b) && !tried[blocks[b].tool]) {
+					tried[blocks[b].tool] = true;
+					run(b);
+				}
+			}
+		}
+		return memo[key] = best;
+	};
+
+	// Follow the choices. With too many blocks, or circular constraints, take
+	// the first available block instead.
+	std::vector<size_t> order;
+	if (n <= 16 && solve(0, none).first < unsolvable) {
+		uint64_t mask = 0;
+		size_t last = none;
+		for (size_t k=0; k<n; k++) {
+			size_t b = solve(mask, last).second;
+			order.push_back(b);
+			done[b] = true;
+			mask |= uint64_t(1) << b;
+			last = blocks[b].tool;
+		}
+	} else {
+		size_t last = none;
+		while (order.size() < n) {
+			size_t next = none;
+			for (size_t b=0; b<n && next == none; b++)
+				if (available(b) && blocks[b].tool == last)
+					next = b;
+			for (size_t b=0; b<n && next == none; b++)
+				if (available(b))
+					next = b;
+			if (next == none)
+				break;
+			order.push_back(next);
+			done[next] = true;
+			last = blocks[next].tool;
+		}
+		for (size_t b=0; b<n; b++)
+			if (!done[b])
+				order.push_back(b);
+	}
+
+	size_t changes_after = 0;
+	auto out = begin;
+	for (size_t k=0; k<n; k++) {
+		auto &paths = blocks[order[k]].paths;
+		out = std::copy(paths.begin(), paths.end(), out);
+		if (k && blocks[order[k]].tool != blocks[order[k-1]].tool)
+			changes_after++;
+	}
+	return {changes_before, changes_after};
+}
+
+}
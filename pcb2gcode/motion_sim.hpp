@@ -0,0 +1,137 @@
+#pragma once
+#include <pcb2gcode.hpp>
+#include <limits>
+
+namespace pcb2gcode {
+
+/* Machining time, by simulating a look-ahead motion planner as in GRBL or
+ * LinuxCNC.
+ *
+ * Moves are queued as straight blocks. The speed through the corner between
+ * two blocks is limited by junction deviation: the corner is taken as an arc
+ * that stays within `junction_deviation` of it, at the speed where centripetal
+ * acceleration reaches the limit. Reversals stop, straight joints do not.
+ * A backward pass then makes sure every block can slow down in time for the
+ * next, a forward pass that it can reach its exit speed, and each block runs
+ * a trapezoidal profile (triangular if short) between them.
+ *
+ * Speed and acceleration of each block are limited per axis, as in a rapid.
+ * The machine stops at flush(), e.g. for tool changes, and at the end. Up to
+ * `lookahead` blocks are planned at once, like the planner buffer.
+ *
+ * The time of each block is added to times[tag].
+ */
+class motion_sim_t {
+	struct block_t {
+		double length; // mm
+		double unit[3];
+		double speed; // Nominal, mm/s
+		double accel; // mm/s²
+		double max_entry; // mm/s
+		double entry; // Planned, mm/s
+		size_t tag;
+	};
+
+	const machine_t &machine;
+	std::vector<block_t> queue;
+	bool moving{false}; // Last block known, and not stopped after it
+	block_t last;
+
+	// Seconds to run a block from entry speed v0 to exit speed v1.
+	static double block_time(const block_t &b, double v0, double v1) {
+		double vn = b.speed, a = b.accel, L = b.length;
+		double da = (vn*vn - v0*v0) / (2*a);
+		double dd = (vn*vn - v1*v1) / (2*a);
+		if (da + dd <= L)
+			return (vn - v0)/a + (vn - v1)/a + (L - da - dd)/vn;
+		double vp = sqrt((2*a*L + v0*v0 + v1*v1) / 2); // Peak of a triangle
+		return std::max(0.0, (vp - v0)/a) + std::max(0.0, (vp - v1)/a);
+	}
+
+	// Plans the queue to a stop, and runs its first `count` blocks.
+	void plan(size_t count) {
+		size_t n = queue.size();
+		double next = 0;
+		for (size_t i=n; i-- > 0; ) {
+			auto &b = queue[i];
+			b.entry = std::min(b.max_entry, sqrt(next*next + 2*b.accel*b.length));
+			next = b.entry;
+		}
+		for (size_t i=0; i<n; i++) {
+			auto &b = queue[i];
+			double exit = std::min(i+1 < n ? queue[i+1].entry : 0, sqrt(b.entry*b.entry + 2*b.accel*b.length));
+			if (i+1 < n)
+				queue[i+1].entry = exit;
+			if (i < count) {
+				if (times.size() <= b.tag)
+					times.resize(b.tag+1, 0);
+				times[b.tag] += block_time(b, b.entry, exit);
+			}
+		}
+
+		queue.erase(queue.begin(), queue.begin() + count);
+		// Already moving into what is left.
+		if (!queue.empty())
+			queue.front().max_entry = queue.front().entry;
+	}
+
+public:
+	const size_t lookahead = 256;
+	std::vector<double> times; // s, by tag
+
+	explicit motion_sim_t(const machine_t &machine) : machine(machine) {}
+
+	// Straight move, at feed (mm/min), or as fast as possible if 0.
+	void move(const double from[3], const double to[3], double feed, size_t tag) {
+		block_t b;
+		double d[3], length2 = 0;
+		for (int i=0; i<3; i++) {
+			d[i] = to[i] - from[i];
+			length2 += d[i] * d[i];
+		}
+		b.length = sqrt(length2);
+		if (!(b.length > 1e-9))
+			return;
+
+		b.speed = feed > 0 ? feed / 60 : std::numeric_limits<double>::infinity();
+		b.accel = std::numeric_limits<double>::infinity();
+		for (int i=0; i<3; i++) {
+			b.unit[i] = d[i] / b.length;
+			double u = fabs(b.unit[i]);
+			if (u > 1e-9) {
+				b.speed = std::min(b.speed, machine.velocity[i] / 60 / u);
+				b.accel = std::min(b.accel, machine.acceleration[i] / u);
+			}
+		}
+		b.tag = tag;
+
+		b.max_entry = 0;
+		if (moving) {
+			double cos = -(last.unit[0]*b.unit[0] + last.unit[1]*b.unit[1] + last.unit[2]*b.unit[2]);
+			double v;
+			if (cos > 0.999999) {
+				v = 0; // Reversal
+			} else if (cos < -0.999999) {
+				v = std::numeric_limits<double>::infinity(); // Straight
+			} else {
+				double sin = sqrt(0.5 * (1 - cos)); // Of half the angle
+				v = sqrt(std::min(last.accel, b.accel) * machine.junction_deviation * sin / (1 - sin));
+			}
+			b.max_entry = std::min({v, last.speed, b.speed});
+		}
+
+		queue.push_back(b);
+		last = b;
+		moving = true;
+		if (queue.size() >= lookahead)
+			plan(lookahead / 2);
+	}
+
+	// Comes to a stop.
+	void flush() {
+		plan(queue.size());
+		moving = false;
+	}
+};
+
+}
@@ -1,5 +1,7 @@
 #include <pcb2gcode.hpp>
-#include <boost/range/adaptor/reversed.hpp>
+#include <pcb2gcode/metapath_sort_tiles.hpp>
+#include <pcb2gcode/motion_sim.hpp>
+#include <pcb2gcode/writer.hpp>
 
 using namespace std;
 
@@ -7,93 +9,357 @@ namespace pcb2gcode {
 
 int DebugImageSave_counter=0;
 
+// Distances and machining time of the moves written, by tool and by job.
+// Time comes from a simulated motion planner, see motion_sim_t.
 struct StatisticsCollector {
-    static double distance(point_t from, point_t to) {
-        double dx = (from.x - to.x);
-        double dy = (from.y - to.y);
-        return sqrt(dx * dx + dy * dy);
-    }
+    enum kind_e { cut, rapid, plunge, kinds };
+    struct times_t {
+        double time[kinds] {0, 0, 0}; // s
+        int tool_changes {0};
+    };
 
-    double mill_time {0};
+    const machine_t &machine;
+    motion_sim_t sim;
     double mill_distance {0};
     double fast_distance {0};
+    int tool_changes {0};
+
+    // Tool and job of each path; block tags are kind + kinds*owner.
+    std::vector<std::pair<const tool_t *, const std::string *>> owners;
+    std::vector<int> owner_tool_changes;
+    size_t owner {0};
 
-    double x{NAN}, y, z;
-    tool_t tool;
+    StatisticsCollector(const machine_t &m) : machine(m), sim(m) {}
+
+    size_t owner_of(std::pair<const tool_t *, const std::string *> o) {
+        size_t i = std::find(owners.begin(), owners.end(), o) - owners.begin();
+        if (i == owners.size()) {
+            owners.push_back(o);
+            owner_tool_changes.push_back(0);
+        }
+        return i;
+    }
 
-    static double motion_time(double d, double vm=1000, double am=60000){
-        d = fabs(d); // Convert distance to mm
-        double tm = vm / am; // Time to max speed
-        double dm = vm * vm / 2 / am; // Distance to max speed
+    void start(const metapath_t &metapath) {
+        owner = owner_of(std::make_pair((const tool_t *)metapath.tool, metapath.job));
+    }
 
-        d /= 2;
-        if (d < dm)
-            return 2 * (sqrt(2 * d / am));
+    // Straight move; feed 0 for rapids.
+    void move(const double from[3], const double to[3], double feed) {
+        double dxy = hypot(to[0] - from[0], to[1] - from[1]);
+        kind_e kind = !feed ? rapid : dxy > 0 ? cut : plunge;
+        if (kind == rapid)
+            fast_distance += dxy;
         else
-            return 2 * (tm + (d - dm) / vm);
+            mill_distance += dxy;
+        sim.move(from, to, feed, kind + kinds*owner);
+    }
+
+    // Arc in the XY plane, as chords within 1µm, as controllers do.
+    void arc(const double from[3], const double to[3], double cx, double cy, bool cw, double feed) {
+        double r = hypot(from[0] - cx, from[1] - cy);
+        double a0 = atan2(from[1] - cy, from[0] - cx);
+        double a1 = atan2(to[1] - cy, to[0] - cx);
+        double sweep = cw ? a0 - a1 : a1 - a0;
+        if (sweep <= 0)
+            sweep += 2*M_PI;
+        double step = r > 0.001 ? 2*acos(1 - 0.001/r) : M_PI;
+        int n = std::max(1, int(ceil(sweep/step)));
+
+        double p[3] = {from[0], from[1], from[2]};
+        for (int k=1; k<=n; k++) {
+            double a = a0 + (cw ? -1 : +1) * sweep * k / n;
+            double q[3] = {cx + r*cos(a), cy + r*sin(a), from[2] + (to[2] - from[2]) * k / n};
+            if (k == n)
+                q[0] = to[0], q[1] = to[1];
+            move(p, q, feed);
+            std::copy(q, q+3, p);
+        }
     }
 
-    void operator()(double nx, double ny, double nz) {
-        double dx = nx-x;
-        double dy = ny-y;
-        double dz = nz-z;
-        double d = sqrt(dx*dx+dy*dy);
+    void tool_change() {
+        sim.flush();
+        tool_changes++;
+        owner_tool_changes[owner]++;
+    }
 
-        bool fast = !tool.feed || isnan(dz) || z>0 && nz>0;
+    void finish() {
+        sim.flush();
+        sim.times.resize(kinds * owners.size(), 0);
+    }
 
-        x = nx;
-        y = ny;
-        z = nz;
+    // Adds n times what a finished collector saw, e.g. a subroutine called
+    // on n tiles.
+    void merge(const StatisticsCollector &other, int n) {
+        mill_distance += n * other.mill_distance;
+        fast_distance += n * other.fast_distance;
+        for (size_t o=0; o<other.owners.size(); o++) {
+            size_t i = owner_of(other.owners[o]);
+            sim.times.resize(std::max(sim.times.size(), kinds * owners.size()), 0);
+            for (int k=0; k<kinds; k++)
+                sim.times[k + kinds*i] += n * other.sim.times[k + kinds*o];
+        }
+    }
 
-        if (!isnan(d)) {
-            mill_time += motion_time(d, fast ? 1000 : tool.feed);
-            if (fast)
-                fast_distance += d;
-            else
-                mill_distance += d;
+    // Times by tool description, or by job name.
+    std::map<std::string, times_t> by(bool job) const {
+        std::map<std::string, times_t> result;
+        for (size_t o=0; o<owners.size(); o++) {
+            auto &t = result[job ? (owners[o].second ? *owners[o].second : "") : owners[o].first->description];
+            for (int k=0; k<kinds; k++)
+                t.time[k] += sim.times[k + kinds*o];
+            t.tool_changes += owner_tool_changes[o];
+        }
+        return result;
+    }
+
+    double total_time() const {
+        double total = tool_changes * machine.tool_change_time;
+        for (double t : sim.times)
+            total += t;
+        return total;
+    }
+};
+
+// Writes G-code words only when they change. Motion (G00 to G03), feed and
+// spindle speed are modal, and so are axes, which are compared as printed.
+// Moves from a known position are also passed to the statistics.
+struct ModalWriter {
+    writer_t &out;
+    StatisticsCollector &st;
+    double scale; // 10^decimals
+    std::string motion;
+    double x{NAN}, y{NAN}, z{NAN}, f{NAN}, s{NAN};
+    double cz{NAN}, cr{NAN}, cq{NAN}; // Canned cycle depth, retract and peck
+    bool spindle {false};
+    bool blank {true}; // Nothing on the line yet
+
+    ModalWriter(writer_t &out, StatisticsCollector &st) : out(out), st(st), scale(pow(10, out.decimals())) {}
+
+    // The value as printed.
+    double printed(double v) const {
+        return std::round(v * scale) / scale;
+    }
+
+    void word(const char *w) {
+        if (!blank)
+            out.write(" ");
+        out.write(w);
+        blank = false;
+    }
+    void word(const char *w, double v) {
+        word(w);
+        out.put(v);
+    }
+    void mode(const char *g) {
+        if (motion == g)
+            return;
+        // Leave canned cycles on a line of its own.
+        if (!motion.compare(0, 2, "G8")) {
+            word("G80");
+            end(nullptr);
+        }
+        word(g);
+        motion = g;
+        cz = cr = cq = NAN;
+    }
+    bool known() const {
+        return !isnan(x) && !isnan(y) && !isnan(z);
+    }
+    void end(const char *comment) {
+        if (comment) {
+            out.write(" ; ");
+            out.write(comment);
+        }
+        out.end_line();
+        blank = true;
+    }
+
+    // G00 or G01 to the given axes, NAN for those that stay. Nothing is
+    // written if no axis moves. Feed is for G01 only.
+    void move(const char *g, double nx, double ny, double nz, double feed=NAN, const char *comment=nullptr) {
+        nx = isnan(nx) ? x : printed(nx);
+        ny = isnan(ny) ? y : printed(ny);
+        nz = isnan(nz) ? z : printed(nz);
+        bool mx = nx != x && !isnan(nx);
+        bool my = ny != y && !isnan(ny);
+        bool mz = nz != z && !isnan(nz);
+        if (!mx && !my && !mz)
+            return;
+
+        bool was_known = known();
+        double from[3] = {x, y, z};
+        mode(g);
+        if (mx) word("X", x = nx);
+        if (my) word("Y", y = ny);
+        if (mz) word("Z", z = nz);
+        if (!isnan(feed) && printed(feed) != f)
+            word("F", f = printed(feed));
+        end(comment);
+
+        double to[3] = {x, y, z};
+        if (was_known)
+            st.move(from, to, motion == "G00" ? 0 : f);
+    }
+
+    // Controllers reject arcs whose start and end radii differ by more than
+    // about this, as printed (LinuxCNC: 0.002 mm).
+    static constexpr double radius_tolerance = 0.002;
+
+    // G02 (clockwise) or G03, always with the end point and the center,
+    // relative to the start as printed. When rounding leaves the end off the
+    // printed circle, lines are written instead, each within tol of the arc.
+    void arc(bool cw, double nx, double ny, double cx, double cy, double feed, double tol) {
+        double i = printed(cx - x), j = printed(cy - y);
+        if (fabs(hypot(printed(nx) - x - i, printed(ny) - y - j) - hypot(i, j)) > radius_tolerance) {
+            double r = hypot(x - cx, y - cy);
+            double a0 = atan2(y - cy, x - cx);
+            double a1 = atan2(ny - cy, nx - cx);
+            double sweep = cw ? a0 - a1 : a1 - a0;
+            if (sweep <= 0)
+                sweep += 2*M_PI;
+            double step = tol < r ? 2*acos(1 - tol/r) : M_PI/2;
+            int n = std::max(1, int(ceil(sweep/step)));
+            for (int k=1; k<n; k++) {
+                double a = a0 + (cw ? -sweep : sweep)*k/n;
+                move("G01", cx + r*cos(a), cy + r*sin(a), NAN, feed);
+            }
+            move("G01", nx, ny, NAN, feed);
+            return;
+        }
+
+        double from[3] = {x, y, z};
+        mode(cw ? "G02" : "G03");
+        word("X", x = printed(nx));
+        word("Y", y = printed(ny));
+        word("I", i);
+        word("J", j);
+        if (printed(feed) != f)
+            word("F", f = printed(feed));
+        end(nullptr);
+
+        double to[3] = {x, y, z};
+        st.arc(from, to, cx, cy, cw, f);
+    }
+
+    // A hole by canned cycle, from and back to height r: G81 in one go, or
+    // G83 pecking q deep at a time, from r. Every hole gives X and Y; the
+    // rest is only written when it changes.
+    void drill(double nx, double ny, double depth, double r, double q, double feed) {
+        bool was_known = known();
+        double from[3] = {x, y, z};
+        if (motion.compare(0, 2, "G8"))
+            word("G98"); // Return to the initial height
+        mode(q > 0 ? "G83" : "G81");
+        nx = printed(nx);
+        ny = printed(ny);
+        word("X", x = nx);
+        word("Y", y = ny);
+        if (printed(depth) != cz)
+            word("Z", cz = printed(depth));
+        if (printed(r) != cr)
+            word("R", cr = printed(r));
+        if (q > 0 && printed(q) != cq)
+            word("Q", cq = printed(q));
+        if (printed(feed) != f)
+            word("F", f = printed(feed));
+        end(nullptr);
+        z = cr;
+
+        // Rapid over the hole, then feed down by pecks, all the way back up
+        // after each, and rapid down to the last depth.
+        if (!was_known)
+            return;
+        double above[3] = {x, y, from[2]}, top[3] = {x, y, cr};
+        st.move(from, above, 0);
+        st.move(above, top, 0);
+        double last = cr;
+        for (double d = q > 0 ? std::max(cr - q, cz) : cz; ; d = std::max(d - q, cz)) {
+            double down[3] = {x, y, last}, bottom[3] = {x, y, d};
+            st.move(top, down, 0);
+            st.move(down, bottom, f);
+            st.move(bottom, top, 0);
+            last = d;
+            if (d <= cz)
+                break;
+        }
+    }
+
+    // Leaves canned cycles, e.g. before returning from a subroutine.
+    void finish() {
+        if (!motion.compare(0, 2, "G8")) {
+            word("G80");
+            end(nullptr);
+            motion.clear();
         }
+    }
 
-        if (!isnan(dz))
-            mill_time += motion_time(dz, tool.plunge);
+    // After a subroutine call, nothing is known but the spindle.
+    void forget() {
+        motion.clear();
+        x = y = z = f = NAN;
+        cz = cr = cq = NAN;
     }
-    void operator()(double nx, double ny) {
-        (*this)(nx,ny,z);
+
+    void spindle_on(double speed, const char *comment) {
+        if (spindle && printed(speed) == s)
+            return;
+        word("M3");
+        word("S", s = printed(speed));
+        end(comment);
+        spindle = true;
     }
-    void operator()(double nz) {
-        (*this)(x,y,nz);
+    void spindle_off(const char *comment=nullptr) {
+        word("M5");
+        end(comment);
+        spindle = false;
     }
 };
 
 #define fail(s) (throw std::string(s))
 
-std::vector<std::string> out_gcode(context_t &context, const metapaths_t &paths, bool mirror) {
+// True if a tool of diameter d (px) can move from a to b without leaving the
+// free area. Tools ride the edges of copper, so one pixel of slack is given.
+static bool link_is_free(const cv::Mat &free_area, point_t a, point_t b, double d) {
+    int thickness = std::max(1, int(d) - 2);
+    int r = thickness/2 + 1;
+    cv::Rect roi(
+        std::min(a.x, b.x) - r, std::min(a.y, b.y) - r,
+        abs(a.x - b.x) + 2*r + 1, abs(a.y - b.y) + 2*r + 1
+    );
+    if (roi.x < 0 || roi.y < 0 || roi.br().x > free_area.cols || roi.br().y > free_area.rows)
+        return false;
+
+    cv::Mat swept = cv::Mat::zeros(roi.size(), CV_8UC1);
+    cv::line(swept, a - roi.tl(), b - roi.tl(), 255, thickness);
+    return !cv::countNonZero(swept & ~free_area(roi));
+}
+
+void out_gcode(context_t &context, const metapaths_t &paths, bool mirror, writer_t &out) {
     if (paths.empty())
-        return {};
+        return;
 
-    std::vector<std::string> r;
     const double mmpp    = 1/context.ppmm;
     const double zsafe   = context.yaml["zsafe"].as<double>(25);
     const double ztravel = context.yaml["ztravel"].as<double>(3);
-    StatisticsCollector st;
-
-    std::vector<std::string> vs;
-
-    // vs.push_back(str(boost::format( ... ) % ... )); // would be very verbose.
-    // F(...) % ...; // is shorter.
-    struct aux : public boost::format {
-        vector<string> &vs;
-        aux(vector<string> &_vs, std::string s) : boost::format(s), vs(_vs) {}
-        ~aux() { vs.push_back(str()); }
-    };
-    auto F = [&vs](std::string s) {
-        return aux(vs, s);
-    };
-
-    auto X = [&](double x) {
-        return x*mmpp + context.bounds.x;
-    };
-    auto Y = [&](double y) {
-        return (-y*mmpp + context.bounds.y + context.bounds.height) * (mirror ? -1 : +1);
+    const double arc_tolerance = context.yaml["arc-tolerance"].as<double>(0);
+    const bool stay_down = context.yaml["stay-down"].as<bool>(true);
+    const std::string tool_change_code = context.yaml["tool-change-code"].as<std::string>("M0");
+    const bool drill_cycles = context.yaml["drill-cycles"].as<bool>(false);
+    const std::string subroutines = context.yaml["subroutines"].as<std::string>("none");
+    StatisticsCollector st(context.machine);
+
+    // F(...) % ...; writes a line. G writes only what changes.
+    auto &F = out;
+    ModalWriter G(out, st);
+
+    // Pixels to machine coordinates (mm), as placed by export options.
+    auto XY = [&](cv::Point2d p) {
+        p = context.place(p);
+        return cv::Point2d(
+            p.x*mmpp + context.bounds.x,
+            (-p.y*mmpp + context.bounds.y + context.bounds.height) * (mirror ? -1 : +1)
+        );
     };
 
     F("G90 ;  Absolute positioning");
@@ -102,72 +368,230 @@ std::vector<std::string> out_gcode(context_t &context, const metapaths_t &paths,
     F("G94 ; units/minute feed rates");
 //     F("G00 Z%f ; Safe height") % zsafe;
 
+    // Where the last path left the tool, in the program or subroutine.
     bool pen_down = false;
     point_t lastpos(-1,-1);
-    for (auto &metapath : paths) {
-        auto &path = *metapath.path;
+    const cv::Mat *last_free_area = nullptr;
+    point_t last_offset;
+
+    const tool_t *last_tool = nullptr;
+    auto use_tool = [&](const metapath_t &metapath) {
+        auto &tool = *metapath.tool;
+        st.start(metapath);
+        if (last_tool && last_tool != &tool) {
+            // Change tools at safe height, with the spindle stopped.
+            G.move("G00", NAN, NAN, zsafe, NAN, "Tool change");
+            G.spindle_off();
+            F("%s ; %s") % tool_change_code % tool.description;
+            st.tool_change();
+            pen_down = false;
+        }
+        last_tool = &tool;
+        G.spindle_on(tool.speed, "Tool speed");
+    };
+
+    // Cuts one path, written by M, from wherever the last one ended.
+    auto cut = [&](ModalWriter &M, const metapath_t &metapath) {
         auto &tool = *metapath.tool;
-        bool backwards = metapath.backwards;
         double depth = 0;
-        st.tool = tool;
-        F("M3 S%f ; Tool speed") % tool.speed;
+
+        // Mills may stay down to the next path of the same job, tool and tile,
+        // at the same depth, if the move only crosses free area and is faster.
+        // Free areas are those of a single tile.
+        bool same_area = metapath.free_area && last_free_area == metapath.free_area && last_offset == metapath.offset;
+        auto may_stay_down = [&](point_t entry, double depth) {
+            if (!stay_down || !same_area || !pen_down || tool.type != tool_t::mill || M.z != M.printed(-depth))
+                return false;
+
+            double dx = (entry.x - lastpos.x) * mmpp / point_one;
+            double dy = (entry.y - lastpos.y) * mmpp / point_one;
+            double feed = context.machine.feed_time(sqrt(dx*dx + dy*dy), tool.feed);
+            double rapid = context.machine.retract_time + context.machine.rapid_time(dx, dy);
+            return feed < rapid && link_is_free(*metapath.free_area,
+                pixel(lastpos - metapath.offset), pixel(entry - metapath.offset), tool.diameter * context.ppmm);
+        };
+        last_free_area = metapath.free_area;
+        last_offset = metapath.offset;
+
+        // Points in cutting order, closed loops rotated to their entry.
+        points_t points;
+        points.reserve(metapath.path->points.size());
+        metapath.visit_points([&](const point_t &p) { points.push_back(p); });
+
+        // Holes by canned cycle, pecking by infeed, from travel height.
+        if (drill_cycles && tool.type == tool_t::drill && points.size() == 1) {
+            point_t hole = points.front();
+            cv::Point2d h = XY(hole);
+            double peck = tool.infeed > 0 && tool.infeed < tool.depth ? tool.infeed : 0;
+            M.move("G00", NAN, NAN, ztravel);
+            M.drill(h.x, h.y, -tool.depth, ztravel, peck, tool.plunge);
+            lastpos = hole;
+            pen_down = false;
+            return;
+        }
 
         do {
             depth = min(depth + tool.infeed, tool.depth);
-            point_t entry = backwards ? path.points.back() : path.points.front();
+            point_t entry = points.front();
+            cv::Point2d e = XY(entry);
 
             // Move to start of path
-            if (entry != lastpos) {
-                st(ztravel);
-                F("G00 Z%f") % ztravel;
+            if (entry != lastpos && may_stay_down(entry, depth)) {
+                M.move("G01", e.x, e.y, NAN, tool.feed, "Stay down");
+            } else if (entry != lastpos) {
+                M.move("G00", NAN, NAN, ztravel);
                 pen_down = false;
             }
             if (!pen_down) {
-                st(X(entry.x), Y(entry.y));
-                F("G00 X%f Y%f") % X(entry.x) % Y(entry.y);
+                M.move("G00", e.x, e.y, NAN);
             }
 
             // Plunge
-            st(-depth);
-            F("G01 Z%f F%f") % -depth % tool.plunge;
+            if (M.z != M.printed(-depth)) {
+                M.move("G01", NAN, NAN, -depth, tool.plunge);
+            }
             pen_down = true;
 
             // Trace path (only for mills)
             if (tool.type == tool_t::mill) {
-                F("F%f") % tool.feed; // Linear feed for XY moves
-
-                if (backwards) {
-                    for (const auto &point : boost::adaptors::reverse(path.points)) {
-                        st(X(point.x), Y(point.y));
-                        F("G01 X%f Y%f") % X(point.x) % Y(point.y);
-                    }
+                std::vector<cv::Point2d> pts;
+                pts.reserve(points.size());
+                for (const auto &point : points)
+                    pts.push_back(XY(point));
+
+                // Replace runs of short lines by G02/G03 arcs, if enabled.
+                segments_t segments;
+                if (arc_tolerance > 0) {
+                    segments = fit_arcs(pts, arc_tolerance);
                 } else {
-                    for (const auto &point : path.points) {
-                        st(X(point.x), Y(point.y));
-                        F("G01 X%f Y%f") % X(point.x) % Y(point.y);
+                    for (size_t i=1; i<pts.size(); i++)
+                        segments.push_back({segment_t::line, pts[i]});
+                }
+
+                M.move("G01", pts[0].x, pts[0].y, NAN, tool.feed);
+                for (const auto &seg : segments) {
+                    if (seg.type == segment_t::line) {
+                        M.move("G01", seg.end.x, seg.end.y, NAN, tool.feed);
+                    } else {
+                        M.arc(seg.type == segment_t::arc_cw, seg.end.x, seg.end.y, seg.center.x, seg.center.y, tool.feed, arc_tolerance);
                     }
                 }
             }
 
-            lastpos = backwards ? path.points.front() : path.points.back();
+            lastpos = points.back();
 
             // Open paths must be reversed every pass. Closed ones don't.
-            if (path.points.front() != path.points.back())
-                backwards = !backwards;
+            if (points.front() != points.back())
+                std::reverse(points.begin(), points.end());
         } while (depth != tool.depth);
+    };
+
+    // Subroutines for M98 go after the end of the program.
+    memory_sink_t subs_sink;
+    writer_t subs(subs_sink, out.line_end(), out.decimals(), 1<<16);
+
+    if (context.instances.empty() || subroutines == "none") {
+        for (auto &metapath : paths) {
+            use_tool(metapath);
+            cut(G, metapath);
+        }
+    } else {
+        // Panels: each run of paths with one tool is a subroutine, called on
+        // every tile with its offset set by G52. Runs are cut from and back to
+        // travel height, so tiles only need ordering between each other.
+        int number = 100;
+        for (auto begin = paths.begin(); begin != paths.end(); number++) {
+            auto end = std::find_if(begin, paths.end(), [&](const metapath_t &m) { return m.tool != begin->tool; });
+            use_tool(*begin);
+
+            writer_t &body = subroutines == "oword" ? out : subs;
+            StatisticsCollector tile_st(context.machine);
+            ModalWriter B(body, tile_st);
+            pen_down = false;
+            lastpos = point_t(-1,-1);
+            last_free_area = nullptr;
+
+            if (subroutines == "oword")
+                body("o%d sub ; %s") % number % begin->tool->description;
+            else
+                body("O%d ; %s") % number % begin->tool->description;
+            for (auto it = begin; it != end; it++) {
+                tile_st.start(*it);
+                cut(B, *it);
+            }
+            B.move("G00", NAN, NAN, ztravel);
+            B.finish();
+            if (subroutines == "oword")
+                body("o%d endsub") % number;
+            else
+                body("M99");
+            tile_st.finish();
+
+            // Tiles in the order with the least travel between them. Travel
+            // is taken as rapids at travel height.
+            cv::Point2d entry = begin->entry, exit = std::prev(end)->exit;
+            auto order = metapath_sort_tiles(context.instances, entry, exit, machine_cost_t(context.machine, context.ppmm));
+            const point_t *prev = nullptr;
+            for (size_t t : order) {
+                cv::Point2d o = context.instances[t];
+                if (prev) {
+                    cv::Point2d a = XY(exit + cv::Point2d(*prev)), b = XY(entry + o);
+                    double from[3] = {a.x, a.y, ztravel};
+                    double to[3] = {b.x, b.y, ztravel};
+                    st.move(from, to, 0);
+                }
+                prev = &context.instances[t];
+                cv::Point2d d = XY(o) - XY(cv::Point2d(0, 0));
+                F("G52 X%f Y%f") % d.x % d.y;
+                if (subroutines == "oword")
+                    F("o%d call") % number;
+                else
+                    F("M98 P%d") % number;
+            }
+            F("G52 X0 Y0");
+            st.merge(tile_st, order.size());
+            G.forget();
+            begin = end;
+        }
     }
 
-    st(zsafe);
-    F("G00 Z%f   ; Safe Height") % zsafe;
-    F("M5        ; Stop spindle");
+    G.move("G00", NAN, NAN, zsafe, NAN, "Safe Height");
+    G.spindle_off("Stop spindle");
     // Do not go home! Gerbers are frequently far from origin.
 
-    // Output statistics
-    F("; Total mill distance: %f") % st.mill_distance;
-    F("; Total fast distance: %f") % st.fast_distance;
-    F("; Expected duration:   %f") % st.mill_time;
+    // Output statistics, also logged on dry runs.
+    st.finish();
+    std::vector<std::string> report;
+    auto line = [&](const char *fmt, auto... args) {
+        report.push_back(str((boost::format(fmt) % ... % args)));
+    };
+    line("Total mill distance: %.1f mm", st.mill_distance);
+    line("Total fast distance: %.1f mm", st.fast_distance);
+    line("Tool changes:        %d", st.tool_changes);
+    for (bool job : {false, true}) {
+        for (auto &t : st.by(job)) {
+            auto &time = t.second.time;
+            line("%s %s: cut %.2f min, rapid %.2f min, plunge %.2f min, %d tool changes",
+                job ? "Job" : "Tool", t.first,
+                time[st.cut] / 60, time[st.rapid] / 60, time[st.plunge] / 60, t.second.tool_changes);
+        }
+    }
+    line("Expected duration:   %.2f min", st.total_time() / 60);
 
-    return vs;
+    std::string log;
+    for (auto &l : report) {
+        F("; %s") % l;
+        log += "    " + l + "\n";
+    }
+    if (context.dry_run)
+        DEBUGL(log);
+
+    // Subroutines called by M98 follow the end of the program.
+    if (subroutines == "m98" && !context.instances.empty()) {
+        F("M30");
+        subs.flush();
+        out.write(subs_sink.data);
+    }
 }
 
 }
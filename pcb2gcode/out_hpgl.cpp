@@ -1,5 +1,5 @@
 #include <pcb2gcode.hpp>
-#include <boost/range/adaptor/reversed.hpp>
+#include <pcb2gcode/writer.hpp>
 
 using namespace std;
 namespace pcb2gcode {
@@ -10,27 +10,16 @@ namespace pcb2gcode {
 
 //#include "hilbert.h"
 
-std::vector<std::string> out_hpgl(context_t &context, const metapaths_t &paths, bool mirror) {
+void out_hpgl(context_t &context, const metapaths_t &paths, bool mirror, writer_t &out) {
 	if (paths.empty())
-		return {};
+		return;
 
-	std::vector<std::string> r;
 	double mmpp	= 1/context.ppmm;
 	double zsafe   = context.yaml["zsafe"].as<double>(25);
 	double ztravel = context.yaml["ztavel"].as<double>(3);
 
-	std::vector<std::string> vs;
-
-	// vs.push_back(str(boost::format( ... ) % ... )); // would be very verbose.
-	// F(...) % ...; // is shorter.
-	struct aux : public boost::format {
-		vector<string> &vs;
-		aux(vector<string> &_vs, std::string s) : boost::format(s), vs(_vs) {}
-		~aux() { vs.push_back(str()); }
-	};
-	auto F = [&vs](std::string s) {
-		return aux(vs, s);
-	};
+	// F(...) % ...; writes a line.
+	auto &F = out;
 
 	auto X = [&](double x) {
 		return int((x*mmpp + context.bounds.x) / 0.025 + 0.5);
@@ -53,26 +42,21 @@ std::vector<std::string> out_hpgl(context_t &context, const metapaths_t &paths,
 		if (tool.type != tool_t::mill)
 			continue;
 
-		bool backwards = metapath.backwards;
-
-		if (backwards) {
-			F("PU%d,%d;") % X(points.back().x) % Y(points.back().y);
-			F("PD;");
-			for (const auto &point : boost::adaptors::reverse(points))
-				F("PA%d,%d;") % X(point.x) % Y(point.y);
-		} else {
-			F("PU%d,%d;") % X(points.front().x) % Y(points.front().y);
-			F("PD;");
-			for (const auto &point : points)
-				F("PA%d,%d;") % X(point.x) % Y(point.y);
-		}
+		bool first = true;
+		metapath.visit_points([&](const point_t &p) {
+			cv::Point2d point = context.place(p);
+			if (first) {
+				F("PU%d,%d;") % X(point.x) % Y(point.y);
+				F("PD;");
+				first = false;
+			}
+			F("PA%d,%d;") % X(point.x) % Y(point.y);
+		});
 	}
 
 	F("PU0,0;");
 	F("SP;");
 	// Do not go home! Gerbers are frequently far from origin.
-
-	return vs;
 }
 
 }
@@ -1,4 +1,5 @@
 #include <pcb2gcode.hpp>
+#include <pcb2gcode/writer.hpp>
 
 using namespace std;
 namespace pcb2gcode {
@@ -9,25 +10,14 @@ namespace pcb2gcode {
 
 //#include "hilbert.h"
 
-std::vector<std::string> out_ncdrill(context_t &context, const metapaths_t &paths, bool mirror) {
+void out_ncdrill(context_t &context, const metapaths_t &paths, bool mirror, writer_t &out) {
 	if (paths.empty())
-		return {};
+		return;
 
-	std::vector<std::string> r;
 	double mmpp	= 1/context.ppmm;
 
-	std::vector<std::string> vs;
-
-	// vs.push_back(str(boost::format( ... ) % ... )); // would be very verbose.
-	// F(...) % ...; // is shorter.
-	struct aux : public boost::format {
-		vector<string> &vs;
-		aux(vector<string> &_vs, std::string s) : boost::format(s), vs(_vs) {}
-		~aux() { vs.push_back(str()); }
-	};
-	auto F = [&vs](std::string s) {
-		return aux(vs, s);
-	};
+	// F(...) % ...; writes a line.
+	auto &F = out;
 
 	// Format pixel coordinates -> 10.000's of an inch in board space.
 	auto X = [&](double x) -> int {
@@ -80,21 +70,12 @@ std::vector<std::string> out_ncdrill(context_t &context, const metapaths_t &path
 			F("T%d") % tool_id;
 		last_tool_id = tool_id;
 
-		auto &points = metapath.path->points;
-		auto &tool = *metapath.tool;
-		bool backwards = metapath.backwards;
-		double depth = 0;
-
-		if (backwards)
-			for (auto point = points.rbegin(); point != points.rend(); point++)
-				F("X%dY%d") % X(point->x) % Y(point->y);
-		else
-			for (auto point = points.begin(); point != points.end(); point++)
-				F("X%dY%d") % X(point->x) % Y(point->y);
+		metapath.visit_points([&](const point_t &p) {
+			cv::Point2d point = context.place(p);
+			F("X%dY%d") % X(point.x) % Y(point.y);
+		});
 	}
 	F("M30 ; End of file");
-
-	return vs;
 }
 
 }
@@ -1,4 +1,5 @@
 #include <pcb2gcode.hpp>
+#include <pcb2gcode/writer.hpp>
 #include <boost/range/adaptor/reversed.hpp>
 
 using namespace std;
@@ -8,10 +9,10 @@ namespace pcb2gcode {
 
 #define fail(s) (throw std::string(s))
 
-std::vector<std::string> out_preview(context_t &context, const metapaths_t &cr_paths, bool mirror) {
+void out_preview(context_t &context, const metapaths_t &cr_paths, bool mirror, writer_t &out) {
 	metapaths_t paths = cr_paths; // Preview requires a local copy.
 	if (paths.empty())
-		return {};
+		return;
 	
 	// Sort by depth
 	std::sort(paths.begin(), paths.end(),
@@ -20,13 +21,15 @@ std::vector<std::string> out_preview(context_t &context, const metapaths_t &cr_p
 		}
 	);
 
-	std::vector<std::string> r;
 	uint32_t height = context.bounds.height * context.ppmm;
 	uint32_t width  = context.bounds.width  * context.ppmm;
 
-	// HACK: Somehow the bounds do not match gerbv exported size. Copy from inputs.
-	height = context.inputs.begin()->second.rows;
-	width  = context.inputs.begin()->second.cols;
+	// HACK: Somehow the bounds do not match gerbv exported size. Copy from inputs,
+	// unless only toolpaths were loaded.
+	if (!context.inputs.empty()) {
+		height = context.inputs.begin()->second.rows;
+		width  = context.inputs.begin()->second.cols;
+	}
 
 	// Default void is black
 //	DEBUG("Creating Mat2b with size " << width << "x" << height << "...");
@@ -43,9 +46,14 @@ std::vector<std::string> out_preview(context_t &context, const metapaths_t &cr_p
 		uint8_t color = tool.depth > 1 ? 255 : 128;
 		int thickness = tool.diameter * context.ppmm;
 		
-		point_t p0 = points.front();
-		for (auto p1 : points) {
-			cv::line(mPreview, p0, p1, color, thickness);
+		// Drawn between pixels, once placed.
+		auto place = [&](point_t p) {
+			return subpixel(context.place(p + metapath.offset));
+		};
+		point_t p0 = place(points.front());
+		for (auto &p : points) {
+			point_t p1 = place(p);
+			cv::line(mPreview, p0, p1, color, thickness, cv::LINE_8, point_shift);
 			p0 = p1;
 		}
 	}
@@ -53,12 +61,10 @@ std::vector<std::string> out_preview(context_t &context, const metapaths_t &cr_p
 	if (mirror)
 		cv::flip(mPreview, mPreview, 0);
 	
-	// HACK: Formatters must output vector of strings. Needs rework.
+	// Images are binary, so no lines here.
 	std::vector<unsigned char> data;
 	cv::imencode(".png", mPreview, data);
-	const char *p = (const char *)data.data();
-	
-	return {std::string(p, data.size())};
+	out.write(std::string_view((const char *)data.data(), data.size()));
 }
 
 }
@@ -0,0 +1,178 @@
+#pragma once
+#include <pcb2gcode.hpp>
+#include <algorithm>
+
+namespace pcb2gcode {
+
+// Uniform grid over a set of points, for nearest neighbour queries.
+// Points are referred to by their index on the source vector, which must
+// outlive the grid. Points can be removed, but not added.
+class point_grid_t {
+	const std::vector<cv::Point2d> *points;
+	double x0{0}, y0{0}, cell{1};
+	int nx{1}, ny{1};
+	std::vector<size_t> cell_begin; // First slot of each cell
+	std::vector<size_t> cell_size;  // Live points on each cell
+	std::vector<size_t> slots;      // Point indexes, grouped by cell
+	std::vector<size_t> slot_of;    // Inverse of slots, npos if absent
+	size_t live{0};
+
+	int cell_x(double x) const {
+		return std::clamp(int((x - x0) / cell), 0, nx-1);
+	}
+	int cell_y(double y) const {
+		return std::clamp(int((y - y0) / cell), 0, ny-1);
+	}
+	size_t cell_of(size_t id) const {
+		auto &p = (*points)[id];
+		return size_t(cell_y(p.y)) * nx + cell_x(p.x);
+	}
+
+public:
+	static constexpr size_t npos = std::numeric_limits<size_t>::max();
+
+	point_grid_t(const std::vector<cv::Point2d> &pts, const std::vector<size_t> &ids, double per_cell=2)
+		: points(&pts), slot_of(pts.size(), npos), live(ids.size())
+	{
+		if (ids.empty())
+			return;
+
+		double x1 = -INFINITY, y1 = -INFINITY;
+		x0 = y0 = +INFINITY;
+		for (auto id : ids) {
+			x0 = std::min(x0, pts[id].x);
+			y0 = std::min(y0, pts[id].y);
+			x1 = std::max(x1, pts[id].x);
+			y1 = std::max(y1, pts[id].y);
+		}
+
+		// Aim for a few points per cell. Degenerate (flat) sets use a line of cells.
+		double w = x1 - x0, h = y1 - y0;
+		double area = w * h;
+		if (area > 0)
+			cell = std::sqrt(area * per_cell / ids.size());
+		else if (w + h > 0)
+			cell = (w + h) * per_cell / ids.size();
+		nx = std::min<double>(w / cell, 4*ids.size()) + 1;
+		ny = std::min<double>(h / cell, 4*ids.size()) + 1;
+
+		// Counting sort of points into cells
+		cell_begin.assign(size_t(nx)*ny + 1, 0);
+		for (auto id : ids)
+			cell_begin[cell_of(id)+1]++;
+		for (size_t c=1; c<cell_begin.size(); c++)
+			cell_begin[c] += cell_begin[c-1];
+
+		cell_size.assign(size_t(nx)*ny, 0);
+		slots.resize(ids.size());
+		for (auto id : ids) {
+			size_t c = cell_of(id);
+			size_t s = cell_begin[c] + cell_size[c]++;
+			slots[s] = id;
+			slot_of[id] = s;
+		}
+	}
+
+	size_t size() const {
+		return live;
+	}
+
+	bool contains(size_t id) const {
+		return slot_of[id] != npos;
+	}
+
+	// Indexes of all points still on the grid.
+	std::vector<size_t> ids() const {
+		std::vector<size_t> r;
+		r.reserve(live);
+		for (size_t c=0; c<cell_size.size(); c++)
+			for (size_t s=cell_begin[c]; s<cell_begin[c]+cell_size[c]; s++)
+				r.push_back(slots[s]);
+		return r;
+	}
+
+	void remove(size_t id) {
+		if (!contains(id))
+			return;
+
+		// Swap with the last live point of the same cell.
+		size_t c = cell_of(id);
+		size_t s = slot_of[id];
+		size_t last = cell_begin[c] + --cell_size[c];
+		std::swap(slots[s], slots[last]);
+		slot_of[slots[s]] = s;
+		slot_of[id] = npos;
+		live--;
+	}
+
+	// Up to k nearest live points to p, closest first, for which accept(id) is true.
+	template<class Accept>
+	std::vector<size_t> nearest_k(cv::Point2d p, size_t k, Accept accept) const {
+		std::vector<std::pair<double, size_t>> heap; // Max-heap on distance²
+		if (!live || !k)
+			return {};
+
+		auto visit = [&](int x, int y) {
+			if (x < 0 || y < 0 || x >= nx || y >= ny)
+				return;
+			size_t c = size_t(y) * nx + x;
+			for (size_t s=cell_begin[c]; s<cell_begin[c]+cell_size[c]; s++) {
+				size_t id = slots[s];
+				cv::Point2d d = (*points)[id] - p;
+				double d2 = d.x*d.x + d.y*d.y;
+				if (heap.size() == k && d2 >= heap.front().first)
+					continue;
+				if (!accept(id))
+					continue;
+				if (heap.size() == k) {
+					std::pop_heap(heap.begin(), heap.end());
+					heap.pop_back();
+				}
+				heap.emplace_back(d2, id);
+				std::push_heap(heap.begin(), heap.end());
+			}
+		};
+
+		// Search rings of cells around p, until no closer point can exist.
+		int cx = cell_x(p.x), cy = cell_y(p.y);
+		int rmax = std::max({cx, nx-1-cx, cy, ny-1-cy});
+		for (int r=0; r<=rmax; r++) {
+			if (heap.size() == k) {
+				double bound = (r-1) * cell;
+				if (bound > 0 && bound*bound >= heap.front().first)
+					break;
+			}
+
+			if (!r) {
+				visit(cx, cy);
+				continue;
+			}
+			for (int x=cx-r; x<=cx+r; x++) {
+				visit(x, cy-r);
+				visit(x, cy+r);
+			}
+			for (int y=cy-r+1; y<=cy+r-1; y++) {
+				visit(cx-r, y);
+				visit(cx+r, y);
+			}
+		}
+
+		std::sort_heap(heap.begin(), heap.end());
+		std::vector<size_t> r;
+		for (auto &h : heap)
+			r.push_back(h.second);
+		return r;
+	}
+
+	std::vector<size_t> nearest_k(cv::Point2d p, size_t k) const {
+		return nearest_k(p, k, [](size_t) { return true; });
+	}
+
+	// Nearest live point to p, or npos if empty.
+	size_t nearest(cv::Point2d p) const {
+		auto r = nearest_k(p, 1);
+		return r.empty() ? npos : r[0];
+	}
+};
+
+}
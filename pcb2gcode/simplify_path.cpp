@@ -24,8 +24,8 @@ points_t simplify_path(const points_t &src, double tol) {
 
     if (true) {
         for (auto &pt : src) {
-            int dx = pt.x - res.back().x;
-            int dy = pt.y - res.back().y;
+            double dx = pt.x - res.back().x;
+            double dy = pt.y - res.back().y;
             if (dx*dx + dy*dy > tol*tol) {
                 res.push_back(pt);
             }
@@ -0,0 +1,70 @@
+#pragma once
+#include <pcb2gcode.hpp>
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+
+namespace pcb2gcode {
+
+// Destination of formatter output bytes.
+struct sink_t {
+	virtual ~sink_t() { }
+	virtual void write(const char *data, size_t size) = 0;
+	virtual void flush() { }
+};
+
+// Writes to a file descriptor: a file, a pipe, or a socket.
+class fd_sink_t : public sink_t {
+protected:
+	int fd;
+	bool owned;
+
+public:
+	explicit fd_sink_t(int fd, bool owned=false) : fd(fd), owned(owned) { }
+	~fd_sink_t() {
+		if (owned)
+			::close(fd);
+	}
+
+	void write(const char *data, size_t size) override {
+		while (size) {
+			ssize_t n = ::write(fd, data, size);
+			if (n < 0 && errno == EINTR)
+				continue;
+			if (n <= 0)
+				throw error("Write failed: " + std::string(strerror(errno)));
+			data += n;
+			size -= n;
+		}
+	}
+};
+
+// Creates or truncates a file.
+class file_sink_t : public fd_sink_t {
+public:
+	explicit file_sink_t(const std::string &path)
+		: fd_sink_t(::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644), true)
+	{
+		if (fd < 0)
+			throw error("Cannot write " + path + ": " + strerror(errno));
+	}
+};
+
+// Discards everything, e.g. for dry runs.
+class null_sink_t : public sink_t {
+public:
+	void write(const char *, size_t) override { }
+};
+
+// Keeps everything in memory, e.g. text to be written after the rest.
+class memory_sink_t : public sink_t {
+public:
+	std::string data;
+
+	void write(const char *p, size_t size) override {
+		data.append(p, size);
+	}
+};
+
+}
@@ -0,0 +1,163 @@
+#pragma once
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace pcb2gcode {
+
+/* Work-stealing pool of worker threads.
+ *
+ * Work is submitted in batches: run() blocks until all tasks of its batch are
+ * done, and the calling thread runs tasks while it waits, so tasks may start
+ * batches of their own.
+ *
+ * Each worker has its own queue, and threads from outside the pool share one
+ * more. A batch goes to the front of the submitting thread's queue, in order,
+ * so the latest batch is finished first. Idle threads take tasks from the
+ * front of their own queue, else steal from the front of the others. Tasks
+ * therefore start in submission order, e.g. largest first if so sorted.
+ */
+class thread_pool_t {
+	typedef std::function<void()> task_t;
+
+	struct queue_t {
+		std::mutex mutex;
+		std::deque<task_t> tasks;
+	};
+
+	std::vector<std::unique_ptr<queue_t>> queues; // [0] is for outside threads
+	std::vector<std::thread> workers;
+	std::atomic<size_t> queued{0};
+
+	std::mutex mutex; // For sleeping only
+	std::condition_variable cv;
+	bool stopping{false};
+
+	// Queue of the current thread, on this pool.
+	size_t my_queue() const {
+		return current_pool() == this ? current_queue() : 0;
+	}
+	static const thread_pool_t *&current_pool() {
+		static thread_local const thread_pool_t *pool = nullptr;
+		return pool;
+	}
+	static size_t &current_queue() {
+		static thread_local size_t index = 0;
+		return index;
+	}
+
+	// Takes a task from queue q, own queue first, then steals.
+	bool pop(size_t q, task_t &task) {
+		for (size_t k=0; k<queues.size(); k++) {
+			auto &queue = *queues[(q + k) % queues.size()];
+			std::lock_guard<std::mutex> lock(queue.mutex);
+			if (!queue.tasks.empty()) {
+				task = std::move(queue.tasks.front());
+				queue.tasks.pop_front();
+				queued--;
+				return true;
+			}
+		}
+		return false;
+	}
+
+	void wake_all() {
+		std::lock_guard<std::mutex> lock(mutex);
+		cv.notify_all();
+	}
+
+public:
+	explicit thread_pool_t(size_t threads = std::thread::hardware_concurrency()) {
+		// The thread calling run() also works, so one less is needed.
+		size_t n = threads > 1 ? threads - 1 : 0;
+		for (size_t i=0; i<=n; i++)
+			queues.emplace_back(new queue_t);
+
+		for (size_t i=1; i<=n; i++) {
+			workers.emplace_back([this, i] {
+				current_pool() = this;
+				current_queue() = i;
+				task_t task;
+				while (true) {
+					if (pop(i, task)) {
+						task();
+						continue;
+					}
+					std::unique_lock<std::mutex> lock(mutex);
+					cv.wait(lock, [this] { return stopping || queued; });
+					if (stopping)
+						return;
+				}
+			});
+		}
+	}
+
+	~thread_pool_t() {
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			stopping = true;
+		}
+		cv.notify_all();
+		for (auto &w : workers)
+			w.join();
+	}
+
+	static thread_pool_t &instance() {
+		static thread_pool_t pool;
+		return pool;
+	}
+
+	size_t size() const {
+		return workers.size() + 1;
+	}
+
+	// Runs all tasks, returns when done. Rethrows the first exception, if any.
+	void run(std::vector<task_t> tasks) {
+		std::atomic<size_t> pending{tasks.size()};
+		std::exception_ptr error;
+		std::mutex error_mutex;
+
+		size_t q = my_queue();
+		if (true) {
+			auto &queue = *queues[q];
+			std::lock_guard<std::mutex> lock(queue.mutex);
+			for (size_t k=tasks.size(); k--; ) {
+				queue.tasks.emplace_front([this, &pending, &error, &error_mutex, task = std::move(tasks[k])] {
+					try {
+						task();
+					} catch (...) {
+						std::lock_guard<std::mutex> lock(error_mutex);
+						if (!error)
+							error = std::current_exception();
+					}
+					if (!--pending)
+						wake_all();
+				});
+			}
+			queued += tasks.size();
+		}
+		wake_all();
+
+		// Help until the batch is done.
+		task_t task;
+		while (pending) {
+			if (pop(q, task)) {
+				task();
+				continue;
+			}
+			std::unique_lock<std::mutex> lock(mutex);
+			cv.wait(lock, [&] { return !pending || queued; });
+		}
+
+		if (error)
+			std::rethrow_exception(error);
+	}
+};
+
+}
@@ -0,0 +1,233 @@
+#include <pcb2gcode.hpp>
+#include <pcb2gcode/sink.hpp>
+#include <cstring>
+#include <functional>
+#include <memory>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace pcb2gcode {
+
+/* Toolpath file: everything do_outputs() needs from do_inputs() and do_jobs().
+ *
+ * Fixed size records, in native byte order and 8-byte aligned, so the file is
+ * read straight from a memory map:
+ *
+ *   header, tools[], groups[] (job/tool), paths[], points[], strings
+ *
+ * Each group is a run of paths, and each path a run of points, in 1/256 px.
+ * Strings are offsets and sizes in the string block at the end.
+ */
+namespace {
+
+const char magic[8] = {'P', '2', 'G', 'P', 'A', 'T', 'H', 'S'};
+const uint32_t version = 2; // 2: points in 1/256 px
+const uint32_t byte_order = 0x01020304;
+
+struct file_string_t {
+	uint64_t offset, size;
+};
+
+struct file_header_t {
+	char magic[8];
+	uint32_t version;
+	uint32_t byte_order;
+	double ppmm;
+	double bounds[4]; // x, y, width, height (mm)
+	uint64_t tools, groups, paths, points;
+	uint64_t strings; // Bytes
+};
+
+struct file_tool_t {
+	file_string_t name, description, predrill;
+	int32_t type;
+	uint32_t climb;
+	double diameter, angle, speed, feed, plunge, infeed, depth, overlap;
+	uint64_t runs;
+};
+
+struct file_group_t {
+	file_string_t job, tool;
+	uint64_t first, count; // Paths
+};
+
+struct file_path_t {
+	uint64_t first; // Point
+	uint32_t count;
+	int32_t priority;
+	uint32_t reversible;
+	uint32_t reserved;
+};
+
+static_assert(sizeof(point_t) == 8, "Points must be two 32-bit integers.");
+static_assert(point_shift == 8, "Points are saved in 1/256 px.");
+
+}
+
+bool save_toolpaths(context_t &context, std::string file) {
+	std::string strings;
+	auto string = [&](const std::string &s) {
+		file_string_t fs{strings.size(), s.size()};
+		strings += s;
+		return fs;
+	};
+
+	std::vector<file_tool_t> tools;
+	for (auto &t : context.tools) {
+		auto &tool = t.second;
+		file_tool_t ft{};
+		ft.name = string(t.first);
+		ft.description = string(tool.description);
+		ft.predrill = string(tool.predrill);
+		ft.type = tool.type;
+		ft.climb = tool.climb;
+		ft.diameter = tool.diameter;
+		ft.angle = tool.angle;
+		ft.speed = tool.speed;
+		ft.feed = tool.feed;
+		ft.plunge = tool.plunge;
+		ft.infeed = tool.infeed;
+		ft.depth = tool.depth;
+		ft.overlap = tool.overlap;
+		ft.runs = tool.runs;
+		tools.push_back(ft);
+	}
+
+	std::vector<file_group_t> groups;
+	std::vector<file_path_t> paths;
+	uint64_t points = 0;
+	iterate_job_tool_paths(context.job_tool_paths,
+		[&](std::string job, std::string tool, paths_t &jtp) {
+		groups.push_back({string(job), string(tool), paths.size(), jtp.size()});
+		for (auto &path : jtp) {
+			paths.push_back({points, uint32_t(path.points.size()), path.priority, path.reversible, 0});
+			points += path.points.size();
+		}
+	});
+
+	file_header_t header{};
+	memcpy(header.magic, magic, sizeof(magic));
+	header.version = version;
+	header.byte_order = byte_order;
+	header.ppmm = context.ppmm;
+	header.bounds[0] = context.bounds.x;
+	header.bounds[1] = context.bounds.y;
+	header.bounds[2] = context.bounds.width;
+	header.bounds[3] = context.bounds.height;
+	header.tools = tools.size();
+	header.groups = groups.size();
+	header.paths = paths.size();
+	header.points = points;
+	header.strings = strings.size();
+
+	file_sink_t out(file);
+	out.write((const char *)&header, sizeof(header));
+	out.write((const char *)tools.data(), tools.size() * sizeof(file_tool_t));
+	out.write((const char *)groups.data(), groups.size() * sizeof(file_group_t));
+	out.write((const char *)paths.data(), paths.size() * sizeof(file_path_t));
+	iterate_job_tool_paths(context.job_tool_paths,
+		[&](std::string, std::string, paths_t &jtp) {
+		for (auto &path : jtp)
+			out.write((const char *)path.points.data(), path.points.size() * sizeof(point_t));
+	});
+	out.write(strings.data(), strings.size());
+
+	DEBUG("Saved " << paths.size() << " paths, " << points << " points to " << file << ".");
+	return true;
+}
+
+// Tools already in the context, i.e. from the config, are kept: feeds and
+// speeds may be changed without running the jobs again.
+bool load_toolpaths(context_t &context, std::string file) {
+	int fd = ::open(file.c_str(), O_RDONLY);
+	if (fd < 0)
+		throw error("Cannot read " + file + ": " + strerror(errno));
+	struct stat st;
+	if (fstat(fd, &st) < 0 || size_t(st.st_size) < sizeof(file_header_t)) {
+		::close(fd);
+		throw error("Not a toolpath file: " + file);
+	}
+	size_t size = st.st_size;
+	void *map = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+	::close(fd);
+	if (map == MAP_FAILED)
+		throw error("Cannot map " + file + ": " + strerror(errno));
+	std::unique_ptr<void, std::function<void(void *)>> unmap(map, [size](void *p) { munmap(p, size); });
+
+	const char *data = (const char *)map;
+	const auto &header = *(const file_header_t *)data;
+	if (memcmp(header.magic, magic, sizeof(magic)) || header.byte_order != byte_order)
+		throw error("Not a toolpath file, or from another kind of machine: " + file);
+	if (header.version != version)
+		throw error("Unsupported toolpath file version " + std::to_string(header.version) + ": " + file);
+
+	// Sections, checked against the file size before use.
+	size_t offset = sizeof(file_header_t);
+	auto section = [&](uint64_t count, size_t record) {
+		if (count > (size - offset) / record)
+			throw error("Truncated toolpath file: " + file);
+		const char *p = data + offset;
+		offset += count * record;
+		return p;
+	};
+	auto tools = (const file_tool_t *)section(header.tools, sizeof(file_tool_t));
+	auto groups = (const file_group_t *)section(header.groups, sizeof(file_group_t));
+	auto paths = (const file_path_t *)section(header.paths, sizeof(file_path_t));
+	auto points = (const point_t *)section(header.points, sizeof(point_t));
+	auto strings = section(header.strings, 1);
+	auto string = [&](const file_string_t &s) {
+		if (s.offset > header.strings || s.size > header.strings - s.offset)
+			throw error("Corrupt toolpath file: " + file);
+		return std::string(strings + s.offset, s.size);
+	};
+
+	context.ppmm = header.ppmm;
+	context.bounds = cv::Rect2d(header.bounds[0], header.bounds[1], header.bounds[2], header.bounds[3]);
+
+	for (uint64_t t=0; t<header.tools; t++) {
+		auto &ft = tools[t];
+		std::string name = string(ft.name);
+		if (context.tools.count(name))
+			continue;
+		tool_t &tool = context.tools[name];
+		tool.description = string(ft.description);
+		tool.predrill = string(ft.predrill);
+		tool.type = tool_t::type_e(ft.type);
+		tool.climb = ft.climb;
+		tool.diameter = ft.diameter;
+		tool.angle = ft.angle;
+		tool.speed = ft.speed;
+		tool.feed = ft.feed;
+		tool.plunge = ft.plunge;
+		tool.infeed = ft.infeed;
+		tool.depth = ft.depth;
+		tool.overlap = ft.overlap;
+		tool.runs = ft.runs;
+	}
+
+	context.job_tool_paths.clear();
+	for (uint64_t g=0; g<header.groups; g++) {
+		auto &fg = groups[g];
+		if (fg.first > header.paths || fg.count > header.paths - fg.first)
+			throw error("Corrupt toolpath file: " + file);
+		paths_t &jtp = context.job_tool_paths[string(fg.job)][string(fg.tool)];
+		jtp.reserve(fg.count);
+		for (uint64_t p=fg.first; p<fg.first+fg.count; p++) {
+			auto &fp = paths[p];
+			if (fp.first > header.points || fp.count > header.points - fp.first)
+				throw error("Corrupt toolpath file: " + file);
+			path_t path;
+			path.reversible = fp.reversible;
+			path.priority = fp.priority;
+			path.points.assign(points + fp.first, points + fp.first + fp.count);
+			jtp.push_back(std::move(path));
+		}
+	}
+
+	DEBUG("Loaded " << header.paths << " paths, " << header.points << " points from " << file << ".");
+	return true;
+}
+
+}
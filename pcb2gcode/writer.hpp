@@ -0,0 +1,152 @@
+#pragma once
+#include <pcb2gcode/sink.hpp>
+#include <algorithm>
+#include <charconv>
+#include <cstring>
+#include <string>
+#include <string_view>
+#include <type_traits>
+#include <vector>
+
+namespace pcb2gcode {
+
+/* Buffered text output for the formatters.
+ *
+ * Lines are written printf-style, one per call:
+ *
+ *     out("G01 X%f Y%f") % x % y;
+ *
+ * The line ends when the temporary returned by out() goes away. Each %f, %d
+ * or %s takes the next argument, converted by its type: reals are fixed with
+ * `precision` decimals, integers and strings as they are. %% is a plain %.
+ *
+ * Numbers are converted by std::to_chars, straight into a buffer that is
+ * passed to the sink in large blocks. Nothing is allocated per line.
+ */
+class writer_t {
+	sink_t &sink;
+	std::string eol;
+	int precision;
+	std::vector<char> buffer;
+	size_t used{0};
+
+	// Room for n more bytes at the end of the buffer.
+	char *reserve(size_t n) {
+		if (used + n > buffer.size()) {
+			flush();
+			if (n > buffer.size())
+				buffer.resize(n);
+		}
+		return buffer.data() + used;
+	}
+
+public:
+	class line_t {
+		writer_t &w;
+		const char *fmt;
+
+		// Copies the format up to the next conversion, or to its end.
+		void literal() {
+			while (*fmt) {
+				const char *pct = strchr(fmt, '%');
+				if (!pct)
+					pct = fmt + strlen(fmt);
+				w.write(std::string_view(fmt, pct - fmt));
+				fmt = pct;
+				if (fmt[0] != '%' || fmt[1] != '%')
+					return;
+				w.write("%");
+				fmt += 2;
+			}
+		}
+
+	public:
+		line_t(writer_t &w, const char *fmt) : w(w), fmt(fmt) {
+			literal();
+		}
+		line_t(const line_t &) = delete;
+		~line_t() {
+			// Conversions left without arguments are written as they are.
+			w.write(fmt);
+			w.write(w.eol);
+		}
+
+		template<class T>
+		line_t &operator%(const T &v) {
+			if (*fmt)
+				fmt += 2;
+			w.put(v);
+			literal();
+			return *this;
+		}
+	};
+
+	explicit writer_t(sink_t &sink, std::string eol="\n", int precision=6, size_t size=1<<20)
+		: sink(sink), eol(eol), precision(std::clamp(precision, 0, 17)), buffer(size) { }
+	~writer_t() {
+		// Errors are only seen by calling flush() before.
+		try {
+			flush();
+		} catch (...) {
+		}
+	}
+
+	line_t operator()(const char *fmt) {
+		return line_t(*this, fmt);
+	}
+
+	// Decimals of reals.
+	int decimals() const {
+		return precision;
+	}
+
+	// Ends a line built by write() and put().
+	void end_line() {
+		write(eol);
+	}
+
+	// Line end, for writers of the same text elsewhere.
+	const std::string &line_end() const {
+		return eol;
+	}
+
+	// Raw bytes, no line end. Large blocks go straight to the sink.
+	void write(std::string_view s) {
+		if (s.size() > buffer.size() / 2) {
+			flush();
+			sink.write(s.data(), s.size());
+			return;
+		}
+		memcpy(reserve(s.size()), s.data(), s.size());
+		used += s.size();
+	}
+
+	template<class T>
+	void put(const T &v) {
+		if constexpr (std::is_floating_point_v<T>) {
+			// Fixed notation of the largest double, plus decimals.
+			const size_t n = 320 + precision;
+			char *p = reserve(n);
+			used = std::to_chars(p, p + n, double(v), std::chars_format::fixed, precision).ptr - buffer.data();
+		} else if constexpr (std::is_same_v<T, bool>) {
+			write(v ? "1" : "0");
+		} else if constexpr (std::is_same_v<T, char>) {
+			write(std::string_view(&v, 1));
+		} else if constexpr (std::is_integral_v<T>) {
+			const size_t n = 24;
+			char *p = reserve(n);
+			used = std::to_chars(p, p + n, v).ptr - buffer.data();
+		} else {
+			write(std::string_view(v));
+		}
+	}
+
+	void flush() {
+		size_t n = used;
+		used = 0;
+		sink.write(buffer.data(), n);
+		sink.flush();
+	}
+};
+
+}
@@ -0,0 +1,41 @@
+#include <pcb2gcode.hpp>
+#include <pcb2gcode/metapath_sort_entries.hpp>
+#include <cassert>
+
+using namespace pcb2gcode;
+
+int DebugImageSave_counter = 0;
+
+// A closed square loop, entered at its first point.
+static metapath_t loop(path_t &path, bool reversible) {
+	path.points = {{0, 0}, {100, 0}, {100, 100}, {0, 100}, {0, 0}};
+	path.reversible = reversible;
+	metapath_t mp;
+	mp.path = &path;
+	mp.reversible = reversible;
+	mp.entry = mp.exit = mp.rentry = mp.rexit = path.points.front();
+	return mp;
+}
+
+int main() {
+	path_t first, milled, predrilled;
+	first.points = {{200, 200}, {110, 110}};
+	metapaths_t paths(1);
+	paths[0].path = &first;
+	paths[0].entry = paths[0].rentry = first.points.front();
+	paths[0].exit = paths[0].rexit = first.points.back();
+	paths.push_back(loop(milled, true));
+	paths.push_back(loop(predrilled, false));
+
+	metapath_sort_entries(paths.begin(), paths.end());
+
+	// Reversible loops move their entry next to the previous exit.
+	assert(paths[1].start == 2);
+	assert(paths[1].entry == cv::Point2d(100, 100));
+
+	// Predrilled ones are marked not reversible, and keep it on the hole.
+	assert(paths[2].start == 0);
+	assert(paths[2].entry == cv::Point2d(predrilled.points.front()));
+
+	return 0;
+}